@@ -5,6 +5,12 @@
 #include <cmath>
 #include <FreeImagePlus.h>
 #include "Stopwatch.h"
+#include "scheduletuner.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -70,22 +76,102 @@ static void processSerial(const fipImage& input, fipImage& output) {
 	}
 }
 
+#ifdef USE_SSE2
+////////////////////////////////////////////////////////////////////////
+// widens four BGRA pixels to two vectors of 16 bit channels
+static inline void loadPixels(const BYTE* p, __m128i& lo, __m128i& hi) {
+	const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	lo = _mm_unpacklo_epi8(x, _mm_setzero_si128());
+	hi = _mm_unpackhi_epi8(x, _mm_setzero_si128());
+}
+
+////////////////////////////////////////////////////////////////////////
+// dist() of four channels: x*x + y*y is exact in float and clamped to 255*255,
+// so the truncated square root is the same as in dist()
+static inline __m128i dist4(__m128i h, __m128i v, bool high) {
+	const __m128i hv = high ? _mm_unpackhi_epi16(h, v) : _mm_unpacklo_epi16(h, v);
+	const __m128 d2 = _mm_min_ps(_mm_cvtepi32_ps(_mm_madd_epi16(hv, hv)), _mm_set1_ps(255.0f*255.0f));
+	return _mm_cvttps_epi32(_mm_sqrt_ps(d2));
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// 3x3 edge detection of the inner pixels of scanline v using scanline pointers
+static void processRow(const fipImage& input, fipImage& output, int v) {
+	const int bypp = 4;
+	const int w = input.getWidth();
+	const BYTE *r0 = input.getScanLine(v - 1);
+	const BYTE *r1 = input.getScanLine(v);
+	const BYTE *r2 = input.getScanLine(v + 1);
+	BYTE *oPos = output.getScanLine(v);
+	int u = 1;
+
+#ifdef USE_SSE2
+	// four pixels per iteration with 16 bit channels
+	const __m128i alpha = _mm_set1_epi32(0xFF000000);
+
+	for (; u + 4 <= w - 1; u += 4) {
+		const int l = bypp*(u - 1), c = bypp*u, r = bypp*(u + 1);
+		__m128i l0lo, l0hi, c0lo, c0hi, r0lo, r0hi, l1lo, l1hi, r1lo, r1hi, l2lo, l2hi, c2lo, c2hi, r2lo, r2hi;
+
+		loadPixels(r0 + l, l0lo, l0hi); loadPixels(r0 + c, c0lo, c0hi); loadPixels(r0 + r, r0lo, r0hi);
+		loadPixels(r1 + l, l1lo, l1hi);                                 loadPixels(r1 + r, r1lo, r1hi);
+		loadPixels(r2 + l, l2lo, l2hi); loadPixels(r2 + c, c2lo, c2hi); loadPixels(r2 + r, r2lo, r2hi);
+
+		// horizontal filter: top row minus bottom row, vertical filter: left column minus right column
+		const __m128i hLo = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(l0lo, c0lo), r0lo), _mm_add_epi16(_mm_add_epi16(l2lo, c2lo), r2lo));
+		const __m128i hHi = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(l0hi, c0hi), r0hi), _mm_add_epi16(_mm_add_epi16(l2hi, c2hi), r2hi));
+		const __m128i vLo = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(l0lo, l1lo), l2lo), _mm_add_epi16(_mm_add_epi16(r0lo, r1lo), r2lo));
+		const __m128i vHi = _mm_sub_epi16(_mm_add_epi16(_mm_add_epi16(l0hi, l1hi), l2hi), _mm_add_epi16(_mm_add_epi16(r0hi, r1hi), r2hi));
+
+		const __m128i dLo = _mm_packs_epi32(dist4(hLo, vLo, false), dist4(hLo, vLo, true));
+		const __m128i dHi = _mm_packs_epi32(dist4(hHi, vHi, false), dist4(hHi, vHi, true));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(oPos + c), _mm_or_si128(_mm_packus_epi16(dLo, dHi), alpha));
+	}
+#endif
+
+	// remaining pixels
+	for (; u < w - 1; u++) {
+		const RGBQUAD *t = reinterpret_cast<const RGBQUAD*>(r0) + u;
+		const RGBQUAD *m = reinterpret_cast<const RGBQUAD*>(r1) + u;
+		const RGBQUAD *b = reinterpret_cast<const RGBQUAD*>(r2) + u;
+		const int hB = t[-1].rgbBlue + t[0].rgbBlue + t[1].rgbBlue - b[-1].rgbBlue - b[0].rgbBlue - b[1].rgbBlue;
+		const int hG = t[-1].rgbGreen + t[0].rgbGreen + t[1].rgbGreen - b[-1].rgbGreen - b[0].rgbGreen - b[1].rgbGreen;
+		const int hR = t[-1].rgbRed + t[0].rgbRed + t[1].rgbRed - b[-1].rgbRed - b[0].rgbRed - b[1].rgbRed;
+		const int vB = t[-1].rgbBlue + m[-1].rgbBlue + b[-1].rgbBlue - t[1].rgbBlue - m[1].rgbBlue - b[1].rgbBlue;
+		const int vG = t[-1].rgbGreen + m[-1].rgbGreen + b[-1].rgbGreen - t[1].rgbGreen - m[1].rgbGreen - b[1].rgbGreen;
+		const int vR = t[-1].rgbRed + m[-1].rgbRed + b[-1].rgbRed - t[1].rgbRed - m[1].rgbRed - b[1].rgbRed;
+		RGBQUAD *oC = reinterpret_cast<RGBQUAD*>(oPos) + u;
+
+		oC->rgbBlue = dist(hB, vB);
+		oC->rgbGreen = dist(hG, vG);
+		oC->rgbRed = dist(hR, vR);
+		oC->rgbReserved = 255;
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////
 static void processSerialOpt(const fipImage& input, fipImage& output) {
 	const int bypp = 4;
 	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
 	assert(input.getBitsPerPixel() == bypp*8);
 
-	// TODO
+	for (int v = 1; v < (int)output.getHeight() - 1; v++) {
+		processRow(input, output, v);
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////
+// row-parallel version of processSerialOpt; the schedule is set at runtime (see ScheduleTuner)
 static void processParallel(const fipImage& input, fipImage& output) {
 	const int bypp = 4;
 	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
 	assert(input.getBitsPerPixel() == bypp*8);
 
-	// TODO
+	#pragma omp parallel for schedule(runtime)
+	for (int v = 1; v < (int)output.getHeight() - 1; v++) {
+		processRow(input, output, v);
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -148,6 +234,9 @@ int imageProcessing(int argc, const char* argv[]) {
 
 	// process image in parallel and produce out3
 	cout << "Start parallel process" << endl;
+	ScheduleTuner tuner;
+	const OmpSchedule schedule = tuner.tune("processParallel", (int64_t)image.getWidth()*image.getHeight(), [&]() { processParallel(image, out3); });
+	cout << "Schedule: " << schedule << endl;
 	sw.Start();
 	processParallel(image, out3);
 	sw.Stop();
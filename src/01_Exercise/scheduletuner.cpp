@@ -0,0 +1,137 @@
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <limits>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "scheduletuner.h"
+#include "Stopwatch.h"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+static string hostName() {
+#ifdef WIN32
+	const char* name = getenv("COMPUTERNAME");
+	return name ? name : "localhost";
+#else
+	char name[256];
+	if (gethostname(name, sizeof(name)) != 0) return "localhost";
+	name[sizeof(name) - 1] = 0;
+	return name;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+ostream& operator<<(ostream& os, const OmpSchedule& s) {
+	switch (s.m_kind) {
+	case omp_sched_static: os << "static"; break;
+	case omp_sched_dynamic: os << "dynamic"; break;
+	case omp_sched_guided: os << "guided"; break;
+	default: os << "auto"; break;
+	}
+	if (s.m_chunkSize > 0) os << "," << s.m_chunkSize;
+	return os << " with " << s.m_numThreads << " threads";
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+ScheduleTuner::ScheduleTuner(const char* cacheFileName, vector<int> chunkSizes, int repetitions)
+	: m_cacheFileName(cacheFileName)
+	, m_hostName(hostName())
+	, m_chunkSizes(move(chunkSizes))
+	, m_repetitions(repetitions)
+{}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// cache file: one line per entry "host kernel problemSize kind chunkSize numThreads", one entry per host, kernel and problem size
+bool ScheduleTuner::lookup(const string& kernelName, int64_t problemSize, OmpSchedule& s) const {
+	ifstream file(m_cacheFileName);
+	string line, host, kernel;
+	int64_t size;
+	int kind, chunkSize, numThreads;
+	bool found = false;
+
+	while (!found && getline(file, line)) {
+		istringstream is(line);
+		if (is >> host >> kernel >> size >> kind >> chunkSize >> numThreads && host == m_hostName && kernel == kernelName && size == problemSize) {
+			s = { static_cast<omp_sched_t>(kind), chunkSize, numThreads };
+			found = true;
+		}
+	}
+	return found;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// rewrites the cache file, the entry replaces an existing one with the same key
+void ScheduleTuner::store(const string& kernelName, int64_t problemSize, const OmpSchedule& s) const {
+	vector<string> lines;
+	{
+		ifstream file(m_cacheFileName);
+		string line, host, kernel;
+		int64_t size;
+
+		while (getline(file, line)) {
+			istringstream is(line);
+			if (!(is >> host >> kernel >> size && host == m_hostName && kernel == kernelName && size == problemSize)) lines.push_back(line);
+		}
+	}
+
+	ofstream file(m_cacheFileName, ios::trunc);
+	for (const string& line : lines) file << line << '\n';
+	file << m_hostName << ' ' << kernelName << ' ' << problemSize << ' ' << static_cast<int>(s.m_kind) << ' ' << s.m_chunkSize << ' ' << s.m_numThreads << endl;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+OmpSchedule ScheduleTuner::tune(const char* kernelName, int64_t problemSize, const function<void()>& kernel) {
+	OmpSchedule best;
+
+	if (lookup(kernelName, problemSize, best)) {
+		apply(best);
+		return best;
+	}
+
+	// thread counts: powers of two up to the number of processors, and the number of processors
+	vector<int> threads;
+	const int procs = omp_get_num_procs();
+	for (int p = 1; p < procs; p *= 2) threads.push_back(p);
+	threads.push_back(procs);
+
+	const omp_sched_t kinds[] = { omp_sched_static, omp_sched_dynamic, omp_sched_guided };
+	double bestTime = numeric_limits<double>::max();
+	Stopwatch sw;
+
+	best = { omp_sched_static, 0, procs };
+	for (int p : threads) {
+		for (omp_sched_t kind : kinds) {
+			for (int chunkSize : m_chunkSizes) {
+				const OmpSchedule s = { kind, chunkSize, p };
+				double time = numeric_limits<double>::max();
+
+				apply(s);
+				kernel(); // warm-up
+				for (int r = 0; r < m_repetitions; r++) {
+					sw.Start();
+					kernel();
+					sw.Stop();
+					time = min(time, sw.GetElapsedTimeMilliseconds());
+				}
+				if (time < bestTime) {
+					bestTime = time;
+					best = s;
+				}
+			}
+		}
+	}
+	store(kernelName, problemSize, best);
+	apply(best);
+	return best;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+void ScheduleTuner::apply(const OmpSchedule& s) {
+	omp_set_schedule(s.m_kind, s.m_chunkSize);
+	omp_set_num_threads(s.m_numThreads);
+}
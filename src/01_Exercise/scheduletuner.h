@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// OpenMP loop schedule used by loops with schedule(runtime)
+struct OmpSchedule {
+	omp_sched_t m_kind;
+	int m_chunkSize;	// 0: implementation default
+	int m_numThreads;
+};
+
+std::ostream& operator<<(std::ostream& os, const OmpSchedule& s);
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Auto-tuner for OpenMP schedules.
+// Times a kernel across schedule kinds, chunk sizes and thread counts and persists the winner
+// per (kernel, problem size, host) in a cache file. The kernel must use schedule(runtime).
+class ScheduleTuner {
+	std::string m_cacheFileName;
+	std::string m_hostName;
+	std::vector<int> m_chunkSizes;
+	int m_repetitions;
+
+	bool lookup(const std::string& kernelName, int64_t problemSize, OmpSchedule& s) const;
+	void store(const std::string& kernelName, int64_t problemSize, const OmpSchedule& s) const;
+
+public:
+	explicit ScheduleTuner(const char* cacheFileName = "schedule.cache", std::vector<int> chunkSizes = { 0, 16, 256, 4096 }, int repetitions = 3);
+
+	// returns the cached or measured best schedule and applies it
+	OmpSchedule tune(const char* kernelName, int64_t problemSize, const std::function<void()>& kernel);
+
+	// sets schedule and number of threads for subsequent parallel regions
+	static void apply(const OmpSchedule& s);
+};
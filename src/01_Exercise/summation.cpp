@@ -1,10 +1,23 @@
 #include <algorithm>
+#include <vector>
+#include <iomanip>
 #include <execution>
 #include <iostream>
 #include <future>
 #include <functional>
+#include <memory>
+#include <cstdio>
 #include <omp.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "Stopwatch.h"
+#include "AlignedBuffer.h"
+#include "TlbCounter.h"
+#include "scheduletuner.h"
 using namespace std;
 
 //////////////////////////////////////////////////////////////////////////////////////////////
@@ -89,17 +102,180 @@ static int64_t sumPar6(const int arr[], const int n) {
 	return sum;
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Schedule and number of threads are chosen at runtime (see ScheduleTuner)
+static int64_t sumParTuned(const int arr[], const int n) {
+	int64_t sum = 0;
+
+#pragma omp parallel for default(shared) reduction(+: sum) schedule(runtime)
+	for (int i = 0; i < n; i++) {
+		sum += arr[i];
+	}
+	return sum;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Naive parallel floating-point summation: the result depends on the number of threads
+template<typename T>
+static T sumParFloat(const T arr[], const int n) {
+	T sum = 0;
+
+#pragma omp parallel for reduction(+: sum)
+	for (int i = 0; i < n; i++) {
+		sum += arr[i];
+	}
+	return sum;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Pairwise summation; the leaves use a fixed number of interleaved partial sums,
+// so the order of all additions only depends on n
+template<typename T>
+static T sumPairwise(const T arr[], const int n) {
+	const int Lanes = 8;
+	const int LeafSize = 256;
+
+	if (n > LeafSize) {
+		const int m = n/2;
+		return sumPairwise(arr, m) + sumPairwise(arr + m, n - m);
+	}
+
+	T part[Lanes] = {};
+	int i = 0;
+	for (; i + Lanes <= n; i += Lanes) {
+		for (int l = 0; l < Lanes; l++) part[l] += arr[i + l];
+	}
+	for (int l = 0; i < n; i++, l++) part[l] += arr[i];
+	return ((part[0] + part[1]) + (part[2] + part[3])) + ((part[4] + part[5]) + (part[6] + part[7]));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Reproducible parallel floating-point summation:
+// fixed-size blocks are summed pairwise in parallel, then the block sums are combined
+// in fixed order with Kahan summation, so the result is independent of threads and schedule
+template<typename T>
+static T sumParRepro(const T arr[], const int n) {
+	const int BlockSize = 4096;
+	const int nBlocks = (n + BlockSize - 1)/BlockSize;
+	vector<T> blockSums(nBlocks);
+
+#pragma omp parallel for schedule(static)
+	for (int b = 0; b < nBlocks; b++) {
+		blockSums[b] = sumPairwise(arr + b*BlockSize, min(BlockSize, n - b*BlockSize));
+	}
+
+	T sum = 0, c = 0;
+	for (int b = 0; b < nBlocks; b++) {
+		const T y = blockSums[b] - c;
+		const T t = sum + y;
+		c = (t - sum) - y;
+		sum = t;
+	}
+	return sum;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Parallel reduction of one chunk of a streamed file
+static int64_t sumChunk(const int arr[], const int64_t n) {
+	int64_t sum = 0;
+
+#pragma omp parallel for reduction(+: sum)
+	for (int64_t i = 0; i < n; i++) {
+		sum += arr[i];
+	}
+	return sum;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Out-of-core summation of a binary file of ints with double buffering:
+// the next chunk is read by an asynchronous task while the current chunk is reduced in parallel
+static bool sumFileBuffered(const char* fileName, int64_t& sum, const size_t chunkSize) {
+	FILE* file = fopen(fileName, "rb");
+	if (!file) {
+		perror("Error");
+		return false;
+	}
+#ifndef WIN32
+	posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	const size_t chunkLen = chunkSize/sizeof(int);
+	unique_ptr<int[]> buffers[] = { unique_ptr<int[]>(new int[chunkLen]), unique_ptr<int[]>(new int[chunkLen]) };
+	int cur = 0;
+
+	sum = 0;
+	size_t n = fread(buffers[cur].get(), sizeof(int), chunkLen, file);
+	while (n > 0) {
+		int* next = buffers[1 - cur].get();
+		future<size_t> prefetch = async(launch::async, [=]() { return fread(next, sizeof(int), chunkLen, file); });
+
+		sum += sumChunk(buffers[cur].get(), n);
+		n = prefetch.get();
+		cur = 1 - cur;
+	}
+	const bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+#ifndef WIN32
+//////////////////////////////////////////////////////////////////////////////////////////////
+// Out-of-core summation of a memory-mapped binary file of ints:
+// the kernel reads ahead the next chunk while the current chunk is reduced in parallel,
+// and pages of reduced chunks are released again, so the file never has to be resident
+static bool sumFileMapped(const char* fileName, int64_t& sum, const size_t chunkSize) {
+	const int fd = open(fileName, O_RDONLY);
+	if (fd < 0) {
+		perror("Error");
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		perror("Error");
+		close(fd);
+		return false;
+	}
+	const size_t size = st.st_size - st.st_size%sizeof(int);
+
+	sum = 0;
+	if (size == 0) {
+		close(fd);
+		return true;
+	}
+	char* base = static_cast<char*>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror("Error");
+		return false;
+	}
+	madvise(base, size, MADV_SEQUENTIAL);
+	madvise(base, min(chunkSize, size), MADV_WILLNEED);
+
+	for (size_t offset = 0; offset < size; offset += chunkSize) {
+		const size_t len = min(chunkSize, size - offset);
+		const size_t nextOffset = offset + len;
+
+		if (nextOffset < size) madvise(base + nextOffset, min(chunkSize, size - nextOffset), MADV_WILLNEED);
+		sum += sumChunk(reinterpret_cast<const int*>(base + offset), len/sizeof(int));
+		madvise(base + offset, len, MADV_DONTNEED);
+	}
+	munmap(base, size);
+	return true;
+}
+#endif
+
 //////////////////////////////////////////////////////////////////////////////////////////////
 // Different summation tests
 void summation() {
 	cout << "\nSummation Tests" << endl;
 
 	const int64_t N = 10000000;
-	int* arr = new int[N];
+	Memory::AlignedArray<int> buffer = Memory::makeAligned<int>(N, true);
+	int* arr = buffer.get();
 
 	for (int i = 1, j = 0; i <= N; i++, j++) arr[j] = i;
 
 	Stopwatch sw;
+	TlbCounter tlb;
 
 	sw.Start();
 	int64_t sum0 = sum(N);
@@ -112,6 +288,28 @@ void summation() {
 	cout << "Sequential:              sumS: " << sumS << " in " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
 	cout << boolalpha << "The two operations produce the same results: " << (sumS == sum0) << endl << endl;
 
+	// TLB misses of a plain heap array compared to the huge-page array
+	if (tlb.IsAvailable()) {
+		int* plain = new int[N];
+		copy(arr, arr + N, plain);
+
+		// the sums are used, so the summation runs between Start and Stop
+		tlb.Start();
+		const int64_t sumPlain = sumSerial(plain, N);
+		tlb.Stop();
+		const int64_t plainMisses = tlb.GetMisses();
+
+		tlb.Start();
+		const int64_t sumHuge = sumSerial(arr, N);
+		tlb.Stop();
+		cout << "new[]:                   sum: " << sumPlain << ", huge pages: sum: " << sumHuge << endl;
+		cout << boolalpha << "The two operations produce the same results: " << (sumPlain == sum0 && sumHuge == sum0) << endl;
+		cout << "dTLB misses: new[]: " << plainMisses << ", huge pages: " << tlb.GetMisses() << ", reduction = " << (double)plainMisses/max<int64_t>(tlb.GetMisses(), 1) << endl << endl;
+		delete[] plain;
+	} else {
+		cout << "dTLB misses: not available" << endl << endl;
+	}
+
 	sw.Start();
 	int64_t sum1 = sumPar1(arr, N);
 	sw.Stop();
@@ -148,5 +346,73 @@ void summation() {
 	cout << "                         sum6: " << sum6 << " in " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
 	cout << boolalpha << "The two operations produce the same results: " << (sum6 == sum0) << endl << endl;
 
-	delete[] arr;
+	const int maxThreads = omp_get_max_threads();
+	ScheduleTuner tuner;
+	int64_t sumT;
+	const OmpSchedule schedule = tuner.tune("sumParTuned", N, [&]() { sumT = sumParTuned(arr, N); });
+	sw.Start();
+	sumT = sumParTuned(arr, N);
+	sw.Stop();
+	omp_set_num_threads(maxThreads);
+	cout << "Tuned (" << schedule << "): sumT: " << sumT << " in " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
+	cout << boolalpha << "The two operations produce the same results: " << (sumT == sum0) << endl << endl;
+
+	// floating-point summation with different numbers of threads
+	Memory::AlignedArray<double> dbuffer = Memory::makeAligned<double>(N);
+	double* darr = dbuffer.get();
+	double sumD1 = 0, sumR1 = 0;
+	bool naiveSame = true, reproSame = true;
+
+	for (int i = 0; i < N; i++) darr[i] = 1.0/(i + 1);
+	for (int p = 1; p <= 8; p *= 2) {
+		omp_set_num_threads(p);
+
+		sw.Start();
+		const double sumD = sumParFloat(darr, N);
+		sw.Stop();
+		const double naiveTime = sw.GetElapsedTimeMilliseconds();
+
+		sw.Start();
+		const double sumR = sumParRepro(darr, N);
+		sw.Stop();
+		cout << "Floating-point (p = " << p << "): naive: " << setprecision(17) << sumD << setprecision(6) << " in " << naiveTime << " ms, reproducible: " << setprecision(17) << sumR << setprecision(6) << " in " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
+
+		if (p == 1) {
+			sumD1 = sumD;
+			sumR1 = sumR;
+		}
+		naiveSame = naiveSame && sumD == sumD1;
+		reproSame = reproSame && sumR == sumR1;
+	}
+	omp_set_num_threads(maxThreads);
+	cout << boolalpha << "Naive summation is independent of the number of threads: " << naiveSame << endl;
+	cout << boolalpha << "Reproducible summation is independent of the number of threads: " << reproSame << endl << endl;
+
+	// out-of-core summation of a binary dump of arr
+	const char* fileName = "summation.bin";
+	const size_t chunkSize = 64 << 20; // multiple of the page size
+	FILE* file = fopen(fileName, "wb");
+	bool written = file && fwrite(arr, sizeof(int), N, file) == N;
+
+	if (file) written = fclose(file) == 0 && written;
+	if (written) {
+		int64_t sumF = 0;
+
+		sw.Start();
+		bool ok = sumFileBuffered(fileName, sumF, chunkSize);
+		sw.Stop();
+		cout << "Streamed (buffered):     sumF: " << sumF << " in " << sw.GetElapsedTimeMilliseconds() << " ms, " << N*sizeof(int)/(sw.GetElapsedTimeSeconds()*(1 << 30)) << " GB/s" << endl;
+		cout << boolalpha << "The two operations produce the same results: " << (ok && sumF == sum0) << endl << endl;
+
+	#ifndef WIN32
+		sw.Start();
+		ok = sumFileMapped(fileName, sumF, chunkSize);
+		sw.Stop();
+		cout << "Streamed (mapped):       sumF: " << sumF << " in " << sw.GetElapsedTimeMilliseconds() << " ms, " << N*sizeof(int)/(sw.GetElapsedTimeSeconds()*(1 << 30)) << " GB/s" << endl;
+		cout << boolalpha << "The two operations produce the same results: " << (ok && sumF == sum0) << endl << endl;
+	#endif
+		remove(fileName);
+	} else {
+		cerr << "Binary file not written: " << fileName << endl;
+	}
 }
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <omp.h>
+#include "main.h"
+#include "boundedqueue.h"
+
+namespace fs = std::filesystem;
+
+bool processTyped(const fipImage& input, fipImage& output, int fSize, Border border);
+
+////////////////////////////////////////////////////////////////////////
+// Batch mode: decoding, filtering and encoding run as concurrent pipeline stages connected by bounded queues,
+// so loading and saving hide behind the filter compute. The images in flight live in a fixed pool of slots,
+// which bounds the memory; output buffers are reused as long as consecutive images have the same size and format.
+// Images are filtered in their own pixel format; only formats without typed filter are converted to 32 bits.
+
+struct BatchSlot {
+	string m_inName;
+	string m_outName;
+	fipImage m_input;
+	fipImage m_output;
+};
+
+////////////////////////////////////////////////////////////////////////
+// all regular files of a directory or all lines of a list file
+static bool listFiles(const char* input, vector<string>& files) {
+	error_code ec;
+
+	if (fs::is_directory(input, ec)) {
+		for (const auto& e : fs::directory_iterator(input, ec)) {
+			if (e.is_regular_file(ec)) files.push_back(e.path().string());
+		}
+		sort(files.begin(), files.end());
+		return true;
+	}
+
+	ifstream list(input);
+	if (!list.good()) return false;
+
+	string line;
+	while (getline(list, line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (!line.empty()) files.push_back(line);
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// reallocates output with the pixel format and shape of input, if they differ
+static bool fitOutput(const fipImage& input, fipImage& output) {
+	if (output.getImageType() == input.getImageType() && output.getBitsPerPixel() == input.getBitsPerPixel()
+		&& output.getWidth() == input.getWidth() && output.getHeight() == input.getHeight()) return false;
+
+	output.setSize(input.getImageType(), input.getWidth(), input.getHeight(), input.getBitsPerPixel());
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Processes all images of input (directory or list file) and saves them in outDir: 32 bit images with filter,
+// the other pixel formats with the typed filter of size fSize.
+// Each stage uses its own number of threads; the filter stage runs the OpenMP filters with filterThreads.
+bool processBatch(const char* input, const char* outDir, const ImageFilter& filter, int fSize, Border border, int decoders, int filterThreads, int encoders) {
+	vector<string> files;
+	if (!listFiles(input, files)) {
+		cerr << "Neither a directory nor a file list: " << input << endl;
+		return false;
+	}
+	error_code ec;
+	fs::create_directories(outDir, ec);
+
+	// one slot per worker plus one waiting in each queue
+	const size_t nSlots = decoders + 1 + encoders + 2;
+	vector<unique_ptr<BatchSlot>> slots;
+	BoundedQueue<BatchSlot*> freeSlots(nSlots), decoded(nSlots), filtered(nSlots);
+
+	for (size_t i = 0; i < nSlots; i++) {
+		slots.emplace_back(new BatchSlot);
+		freeSlots.push(slots.back().get());
+	}
+
+	atomic<size_t> nextFile(0);
+	atomic<int> activeDecoders(decoders);
+	atomic<int> nSaved(0), nReallocated(0);
+	vector<Stopwatch> decodeTimes(decoders), encodeTimes(encoders);
+	Stopwatch filterTime, sw;
+	vector<thread> threads;
+
+	sw.Start();
+
+	// decode stage
+	for (int t = 0; t < decoders; t++) {
+		threads.emplace_back([&, t] {
+			size_t i;
+
+			while ((i = nextFile++) < files.size()) {
+				BatchSlot *slot = nullptr;
+				freeSlots.pop(slot);
+
+				decodeTimes[t].Restart();
+				slot->m_inName = files[i];
+				slot->m_outName = (fs::path(outDir)/fs::path(files[i]).filename()).string();
+				const bool loaded = slot->m_input.load(files[i].c_str());
+				decodeTimes[t].Stop();
+
+				if (loaded) {
+					decoded.push(slot);
+				} else {
+					cerr << "Image not loaded: " << files[i] << endl;
+					freeSlots.push(slot);
+				}
+			}
+			if (--activeDecoders == 0) decoded.close();
+		});
+	}
+
+	// filter stage
+	threads.emplace_back([&] {
+		BatchSlot *slot;
+
+		omp_set_num_threads(filterThreads);
+		while (decoded.pop(slot)) {
+			fipImage& in = slot->m_input;
+			fipImage& out = slot->m_output;
+			const bool is32 = in.getImageType() == FIT_BITMAP && in.getBitsPerPixel() == 32;
+			bool ok = true;
+
+			filterTime.Restart();
+			if (fitOutput(in, out)) nReallocated++;
+			if (is32 || !processTyped(in, out, fSize, border)) {
+				// 32 bit images and pixel formats or filter sizes without typed filter
+				ok = is32 || in.convertTo32Bits();
+				if (ok) {
+					if (fitOutput(in, out)) nReallocated++;
+					filter(in, out);
+				}
+			}
+			filterTime.Stop();
+
+			if (ok) {
+				filtered.push(slot);
+			} else {
+				cerr << "Pixel format or filter size not supported: " << slot->m_inName << endl;
+				freeSlots.push(slot);
+			}
+		}
+		filtered.close();
+	});
+
+	// encode stage
+	for (int t = 0; t < encoders; t++) {
+		threads.emplace_back([&, t] {
+			BatchSlot *slot;
+
+			while (filtered.pop(slot)) {
+				encodeTimes[t].Restart();
+				if (slot->m_output.save(slot->m_outName.c_str())) {
+					nSaved++;
+				} else {
+					cerr << "Image not saved: " << slot->m_outName << endl;
+				}
+				encodeTimes[t].Stop();
+				freeSlots.push(slot);
+			}
+		});
+	}
+
+	for (thread& t : threads) t.join();
+	sw.Stop();
+
+	// busy times summed over the threads of a stage
+	double decodeTime = 0, encodeTime = 0;
+	for (const Stopwatch& s : decodeTimes) decodeTime += s.GetElapsedTimeMilliseconds();
+	for (const Stopwatch& s : encodeTimes) encodeTime += s.GetElapsedTimeMilliseconds();
+
+	const double elapsed = sw.GetElapsedTimeMilliseconds();
+	cout << nSaved << " of " << files.size() << " images in " << elapsed << " ms (" << 1000.0*nSaved/elapsed << " images/s)" << endl;
+	cout << "decode " << decodeTime << " ms (" << decoders << " threads), filter " << filterTime.GetElapsedTimeMilliseconds() << " ms (" << filterThreads
+		<< " threads), encode " << encodeTime << " ms (" << encoders << " threads)" << endl;
+	cout << nReallocated << " output buffers allocated for " << nSlots << " slots" << endl;
+	return nSaved == (int)files.size();
+}
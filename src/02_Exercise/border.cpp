@@ -0,0 +1,98 @@
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "main.h"
+#include "magnitude.h"
+
+////////////////////////////////////////////////////////////////////////
+// Border handling: the filters only compute the inner pixels without any bounds checks,
+// the pixels closer than fSize/2 to the image border are computed here with remapped coordinates.
+// The modes correspond to the OpenCL sampler addressing modes:
+// Clamp: CL_ADDRESS_CLAMP_TO_EDGE, Mirror: CL_ADDRESS_MIRRORED_REPEAT, Wrap: CL_ADDRESS_REPEAT, Zero: CL_ADDRESS_CLAMP
+
+// non-zero filter tap: offsets relative to the center and weights of both filters
+struct Tap {
+	int m_dx, m_dy;
+	int m_h, m_v;
+};
+
+////////////////////////////////////////////////////////////////////////
+// maps coordinate x to [0, n), returns -1 for pixels outside of the image in zero mode
+int remap(int x, int n, Border border) {
+	if (x >= 0 && x < n) return x;
+
+	switch(border) {
+	case Border::Clamp:
+		return (x < 0) ? 0 : n - 1;
+	case Border::Mirror:
+		while (x < 0 || x >= n) x = (x < 0) ? -x - 1 : 2*n - x - 1;
+		return x;
+	case Border::Wrap:
+		x %= n;
+		return (x < 0) ? x + n : x;
+	default:
+		return -1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+static void processPixel(const BYTE *input, BYTE *output, int w, int h, size_t stride, const vector<Tap>& taps, Border border, int u, int v) {
+	int hC[3] = { 0, 0, 0 };
+	int vC[3] = { 0, 0, 0 };
+
+	for(const Tap& t: taps) {
+		const int x = remap(u + t.m_dx, w, border);
+		const int y = remap(v + t.m_dy, h, border);
+		if (x < 0 || y < 0) continue;
+
+		const RGBQUAD *iC = reinterpret_cast<const RGBQUAD*>(input + y*stride) + x;
+		hC[0] += t.m_h*iC->rgbBlue;
+		hC[1] += t.m_h*iC->rgbGreen;
+		hC[2] += t.m_h*iC->rgbRed;
+		vC[0] += t.m_v*iC->rgbBlue;
+		vC[1] += t.m_v*iC->rgbGreen;
+		vC[2] += t.m_v*iC->rgbRed;
+	}
+	RGBQUAD *oC = reinterpret_cast<RGBQUAD*>(output + v*stride) + u;
+	storeMagnitude(hC, vC, oC);
+}
+
+////////////////////////////////////////////////////////////////////////
+// computes the fSize/2 wide frame of output: full top and bottom rows, left and right parts of the other rows;
+// input and output are w x h BGRA images with scanlines of stride bytes
+void processBorder(const BYTE *input, BYTE *output, int w, int h, size_t stride, const int *hFilter, const int *vFilter, int fSize, Border border) {
+	const int fSizeD2 = fSize/2;
+	vector<Tap> taps;
+
+	for(int j = 0; j < fSize; j++) {
+		for(int i = 0; i < fSize; i++) {
+			const int fi = j*fSize + i;
+			if (hFilter[fi] || vFilter[fi]) taps.push_back({ i - fSizeD2, j - fSizeD2, hFilter[fi], vFilter[fi] });
+		}
+	}
+
+	#pragma omp parallel for
+	for(int v = 0; v < h; v++) {
+		if (v < fSizeD2 || v >= h - fSizeD2) {
+			for(int u = 0; u < w; u++) {
+				processPixel(input, output, w, h, stride, taps, border, u, v);
+			}
+		} else {
+			for(int u = 0; u < fSizeD2 && u < w; u++) {
+				processPixel(input, output, w, h, stride, taps, border, u, v);
+			}
+			for(int u = max(w - fSizeD2, fSizeD2); u < w; u++) {
+				processPixel(input, output, w, h, stride, taps, border, u, v);
+			}
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+void processBorder(const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize, Border border) {
+	const int bypp = 4;
+	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
+	assert(input.getBitsPerPixel() == bypp*8);
+
+	processBorder(input.getScanLine(0), output.getScanLine(0), input.getWidth(), input.getHeight(), input.getScanWidth(), hFilter, vFilter, fSize, border);
+}
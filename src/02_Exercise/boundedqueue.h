@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+////////////////////////////////////////////////////////////////////////
+// Blocking FIFO with a fixed capacity connecting pipeline stages.
+// push blocks while the queue is full, pop blocks while it is empty.
+// After close, pop returns false as soon as the queue has been drained.
+template<typename T>
+class BoundedQueue {
+	std::deque<T> m_items;
+	size_t m_capacity;
+	bool m_closed;
+	std::mutex m_mutex;
+	std::condition_variable m_notFull;
+	std::condition_variable m_notEmpty;
+
+public:
+	explicit BoundedQueue(size_t capacity) : m_capacity(capacity), m_closed(false) {}
+
+	void push(T item) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notFull.wait(lock, [this] { return m_items.size() < m_capacity; });
+		m_items.push_back(std::move(item));
+		m_notEmpty.notify_one();
+	}
+
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notEmpty.wait(lock, [this] { return !m_items.empty() || m_closed; });
+		if (m_items.empty()) return false;
+		item = std::move(m_items.front());
+		m_items.pop_front();
+		m_notFull.notify_one();
+		return true;
+	}
+
+	// no more items will be pushed: wakes up all waiting consumers
+	void close() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+		m_notEmpty.notify_all();
+	}
+};
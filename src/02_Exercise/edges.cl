@@ -1,16 +1,73 @@
 ////////////////////////////////////////////////////////////////////////
+// the float square root may be off by one for large n, so it is corrected to the exact integer root
 uint dist(int x, int y) {
-	uint d = (uint)sqrt((float)(x*x) + (float)(y*y));
+	const uint n = (uint)(x*x + y*y);
+	uint d = (uint)sqrt((float)n);
+	if ((d + 1)*(d + 1) <= n) d++;
+	else if (d*d > n) d--;
 	return (d < 256) ? d : 255;
 }
 
+////////////////////////////////////////////////////////////////////////
+// Specialized builds define the filter size FSIZE and the row-major taps H_TAPS and V_TAPS,
+// e.g. -D FSIZE=3 -D H_TAPS=0,0,0,0,0,0,0,0,0 -D V_TAPS=...: the convolution loops have constant bounds
+// and constant weights, so the compiler unrolls them and drops the zero taps. The kernel arguments
+// fSize, hFilter and vFilter are ignored then. Without FSIZE they are read at runtime.
+#ifdef FSIZE
+__constant int hTaps[FSIZE*FSIZE] = { H_TAPS };
+__constant int vTaps[FSIZE*FSIZE] = { V_TAPS };
+#define FILTER_SIZE FSIZE
+#define H_FILTER hTaps
+#define V_FILTER vTaps
+#else
+#define FILTER_SIZE fSize
+#define H_FILTER hFilter
+#define V_FILTER vFilter
+#endif
+
 ////////////////////////////////////////////////////////////////////////
 // OpenCL kernel
-__kernel void edges(__read_only image2d_t source, __write_only image2d_t dest, __constant int* hFilter, __constant int* vFilter, int fSize, sampler_t sampler) {
-	const int w = get_global_size(0);
-	const int h = get_global_size(1);
+// Each work-group reads its tile plus a halo of fSize/2 pixels once into local memory (tile),
+// the filter taps are then read from local memory instead of fSize^2 image reads per pixel.
+// The global size is rounded up to multiples of the work-group size, so w and h are passed explicitly.
+// The sampler uses normalized coordinates, so its addressing mode implements the border handling.
+__kernel void edges(__read_only image2d_t source, __write_only image2d_t dest, __constant int* hFilter, __constant int* vFilter, int fSize, sampler_t sampler, int w, int h, __local uchar4* tile) {
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int lw = get_local_size(0);
+	const int lh = get_local_size(1);
+	const int fSizeD2 = FILTER_SIZE/2;
+	const int tw = lw + 2*fSizeD2;
+	const int th = lh + 2*fSizeD2;
+	const int x0 = get_group_id(0)*lw - fSizeD2;
+	const int y0 = get_group_id(1)*lh - fSizeD2;
+	const float2 scale = (float2)(1.0f/w, 1.0f/h);
 
-	// TODO implement edge detection without using local memory
-	// use read_imageui(...) and write_imageui(...) to read/write one pixel of source/dest
-}
+	// all work-items of the group load the tile together
+	for (int j = ly; j < th; j += lh) {
+		for (int i = lx; i < tw; i += lw) {
+			const float2 pos = ((float2)(x0 + i, y0 + j) + 0.5f)*scale;
+			tile[j*tw + i] = convert_uchar4(read_imageui(source, sampler, pos));
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (x >= w || y >= h) return;
+
+	int4 hC = 0;
+	int4 vC = 0;
+	int fi = 0;
 
+	for (int j = 0; j < FILTER_SIZE; j++) {
+		__local const uchar4 *row = tile + (ly + j)*tw + lx;
+
+		for (int i = 0; i < FILTER_SIZE; i++, fi++) {
+			const int4 c = convert_int4(row[i]);
+
+			hC += H_FILTER[fi]*c;
+			vC += V_FILTER[fi]*c;
+		}
+	}
+	write_imageui(dest, (int2)(x, y), (uint4)(dist(hC.x, vC.x), dist(hC.y, vC.y), dist(hC.z, vC.z), 255));
+}
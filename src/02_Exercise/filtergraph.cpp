@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <cstdlib>
+#include "filtergraph.h"
+#include "magnitude.h"
+
+////////////////////////////////////////////////////////////////////////
+// intermediate result of a gradient stage
+struct Gradient {
+	int m_h[3];
+	int m_v[3];
+};
+
+// pixel rectangle [m_x0, m_x1) x [m_y0, m_y1)
+struct Region {
+	int m_x0, m_y0, m_x1, m_y1;
+};
+
+// pixels of a region in image coordinates
+struct Plane {
+	BYTE *m_data;
+	size_t m_stride;
+	int m_x0, m_y0;
+
+	template<typename T>
+	T* at(int x, int y) const { return reinterpret_cast<T*>(m_data + (y - m_y0)*m_stride) + (x - m_x0); }
+};
+
+////////////////////////////////////////////////////////////////////////
+FilterGraph& FilterGraph::blur(int radius) {
+	m_stages.push_back({ Kind::Blur, radius });
+	return *this;
+}
+
+FilterGraph& FilterGraph::gradient(int fSize) {
+	m_stages.push_back({ Kind::Gradient, fSize });
+	return *this;
+}
+
+FilterGraph& FilterGraph::magnitude() {
+	m_stages.push_back({ Kind::Magnitude, 0 });
+	return *this;
+}
+
+FilterGraph& FilterGraph::nonMaxSuppression() {
+	m_stages.push_back({ Kind::NonMaxSuppression, 0 });
+	return *this;
+}
+
+FilterGraph& FilterGraph::threshold(int t) {
+	m_stages.push_back({ Kind::Threshold, t });
+	return *this;
+}
+
+////////////////////////////////////////////////////////////////////////
+bool FilterGraph::isValid() const {
+	bool gradient = false;	// type of the current intermediate
+
+	for (const Stage& s : m_stages) {
+		const bool gradientInput = s.m_kind == Kind::Magnitude || s.m_kind == Kind::NonMaxSuppression;
+		if (gradientInput != gradient) return false;
+		if (s.m_kind == Kind::Gradient && (s.m_param < 3 || (s.m_param & 1) == 0)) return false;
+		if (s.m_kind == Kind::Blur && s.m_param < 0) return false;
+		gradient = s.m_kind == Kind::Gradient;
+	}
+	return !m_stages.empty() && !gradient;
+}
+
+////////////////////////////////////////////////////////////////////////
+int FilterGraph::radius(const Stage& s) {
+	switch (s.m_kind) {
+	case Kind::Blur: return s.m_param;
+	case Kind::Gradient: return s.m_param/2;
+	case Kind::NonMaxSuppression: return 1;
+	default: return 0;
+	}
+}
+
+size_t FilterGraph::pixelSize(const Stage& s) {
+	return (s.m_kind == Kind::Gradient) ? sizeof(Gradient) : sizeof(RGBQUAD);
+}
+
+int FilterGraph::halo(size_t k) const {
+	int r = 0;
+	for (size_t i = k + 1; i < m_stages.size(); i++) r += radius(m_stages[i]);
+	return r;
+}
+
+////////////////////////////////////////////////////////////////////////
+// clamped coordinates [lo - r, hi + r) -> [0, n), indexed by coordinate - lo + r
+static vector<int> clampedRange(int lo, int hi, int r, int n) {
+	vector<int> c(hi - lo + 2*r);
+	for (int i = 0; i < (int)c.size(); i++) c[i] = min(max(lo - r + i, 0), n - 1);
+	return c;
+}
+
+////////////////////////////////////////////////////////////////////////
+// magnitude of channel c is compared with both neighbors along the quantized gradient direction;
+// mags holds the magnitudes around (x, y)
+static BYTE suppress(const Plane& in, const Plane& mags, int x, int y, int c, int w, int h) {
+	const Gradient *g = in.at<Gradient>(x, y);
+	const BYTE m = mags.at<BYTE[4]>(x, y)[0][c];
+
+	// gradient (gx, gy) in scanline coordinates: hFilter is the difference upwards, vFilter the difference to the left
+	const int gx = -g->m_v[c], gy = g->m_h[c];
+	int dx, dy;
+	if (2*abs(gy) <= abs(gx)) { dx = 1; dy = 0; }
+	else if (2*abs(gx) <= abs(gy)) { dx = 0; dy = 1; }
+	else { dx = 1; dy = ((gx > 0) == (gy > 0)) ? 1 : -1; }
+
+	const BYTE m1 = mags.at<BYTE[4]>(min(max(x + dx, 0), w - 1), min(max(y + dy, 0), h - 1))[0][c];
+	const BYTE m2 = mags.at<BYTE[4]>(min(max(x - dx, 0), w - 1), min(max(y - dy, 0), h - 1))[0][c];
+	return (m >= m1 && m > m2) ? m : 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// computes the region r of stage s; in covers r extended by the radius of s, clamped to the w x h image
+static void runStage(const FilterGraph::Stage& s, const Plane& in, const Plane& out, const Region& r, int w, int h) {
+	typedef FilterGraph::Kind Kind;
+
+	switch (s.m_kind) {
+	case Kind::Blur: {
+		const int rad = s.m_param;
+		const int n = (2*rad + 1)*(2*rad + 1);
+		const vector<int> xs = clampedRange(r.m_x0, r.m_x1, rad, w), ys = clampedRange(r.m_y0, r.m_y1, rad, h);
+
+		for (int y = r.m_y0; y < r.m_y1; y++) {
+			RGBQUAD *oC = out.at<RGBQUAD>(r.m_x0, y);
+			for (int x = r.m_x0; x < r.m_x1; x++, oC++) {
+				int sum[3] = { 0, 0, 0 };
+				for (int j = 0; j <= 2*rad; j++) {
+					const int yj = ys[y - r.m_y0 + j];
+					for (int i = 0; i <= 2*rad; i++) {
+						const RGBQUAD *iC = in.at<RGBQUAD>(xs[x - r.m_x0 + i], yj);
+						sum[0] += iC->rgbBlue;
+						sum[1] += iC->rgbGreen;
+						sum[2] += iC->rgbRed;
+					}
+				}
+				oC->rgbBlue = (BYTE)((sum[0] + n/2)/n);
+				oC->rgbGreen = (BYTE)((sum[1] + n/2)/n);
+				oC->rgbRed = (BYTE)((sum[2] + n/2)/n);
+				oC->rgbReserved = 255;
+			}
+		}
+		break;
+	}
+	case Kind::Gradient: {
+		// the edge filters are box sums (see filters.h): hFilter is the row above minus the row below,
+		// vFilter the column left minus the column right, each fSize pixels long
+		const int m = s.m_param/2;
+		const int cw = r.m_x1 - r.m_x0 + 2;
+		const vector<int> xs = clampedRange(r.m_x0, r.m_x1, m, w), ys = clampedRange(r.m_y0, r.m_y1, m, h);
+		vector<int> cols(3*cw);
+
+		for (int y = r.m_y0; y < r.m_y1; y++) {
+			const int *yj = &ys[y - r.m_y0];
+
+			// vertical box sums of the columns [x0 - 1, x1 + 1)
+			fill(cols.begin(), cols.end(), 0);
+			for (int j = 0; j <= 2*m; j++) {
+				int *col = cols.data();
+				for (int c = 0; c < cw; c++, col += 3) {
+					const RGBQUAD *iC = in.at<RGBQUAD>(xs[c - 1 + m], yj[j]);
+					col[0] += iC->rgbBlue;
+					col[1] += iC->rgbGreen;
+					col[2] += iC->rgbRed;
+				}
+			}
+
+			// horizontal box sums of the rows above and below slide along the row
+			const int *xi = &xs[0];
+			int top[3] = { 0, 0, 0 }, bottom[3] = { 0, 0, 0 };
+			for (int i = 0; i <= 2*m; i++) {
+				const RGBQUAD *t = in.at<RGBQUAD>(xi[i], yj[m - 1]), *b = in.at<RGBQUAD>(xi[i], yj[m + 1]);
+				top[0] += t->rgbBlue; top[1] += t->rgbGreen; top[2] += t->rgbRed;
+				bottom[0] += b->rgbBlue; bottom[1] += b->rgbGreen; bottom[2] += b->rgbRed;
+			}
+
+			Gradient *g = out.at<Gradient>(r.m_x0, y);
+			for (int x = r.m_x0; x < r.m_x1; x++, g++, xi++) {
+				const int *left = &cols[3*(x - r.m_x0)], *right = left + 6;
+				for (int c = 0; c < 3; c++) {
+					g->m_h[c] = top[c] - bottom[c];
+					g->m_v[c] = left[c] - right[c];
+				}
+				if (x + 1 == r.m_x1) break;
+
+				const RGBQUAD *tIn = in.at<RGBQUAD>(xi[2*m + 1], yj[m - 1]), *tOut = in.at<RGBQUAD>(xi[0], yj[m - 1]);
+				const RGBQUAD *bIn = in.at<RGBQUAD>(xi[2*m + 1], yj[m + 1]), *bOut = in.at<RGBQUAD>(xi[0], yj[m + 1]);
+				top[0] += tIn->rgbBlue - tOut->rgbBlue; top[1] += tIn->rgbGreen - tOut->rgbGreen; top[2] += tIn->rgbRed - tOut->rgbRed;
+				bottom[0] += bIn->rgbBlue - bOut->rgbBlue; bottom[1] += bIn->rgbGreen - bOut->rgbGreen; bottom[2] += bIn->rgbRed - bOut->rgbRed;
+			}
+		}
+		break;
+	}
+	case Kind::Magnitude:
+		for (int y = r.m_y0; y < r.m_y1; y++) {
+			const Gradient *g = in.at<Gradient>(r.m_x0, y);
+			RGBQUAD *oC = out.at<RGBQUAD>(r.m_x0, y);
+			for (int x = r.m_x0; x < r.m_x1; x++, g++, oC++) storeMagnitude(g->m_h, g->m_v, oC);
+		}
+		break;
+	case Kind::NonMaxSuppression: {
+		// magnitudes of the region extended by one pixel are computed once
+		const int mx0 = max(r.m_x0 - 1, 0), my0 = max(r.m_y0 - 1, 0), mx1 = min(r.m_x1 + 1, w), my1 = min(r.m_y1 + 1, h);
+		vector<RGBQUAD> magBuffer((size_t)(mx1 - mx0)*(my1 - my0));
+		const Plane mags = { reinterpret_cast<BYTE*>(magBuffer.data()), sizeof(RGBQUAD)*(mx1 - mx0), mx0, my0 };
+
+		for (int y = my0; y < my1; y++) {
+			const Gradient *g = in.at<Gradient>(mx0, y);
+			RGBQUAD *oC = mags.at<RGBQUAD>(mx0, y);
+			for (int x = mx0; x < mx1; x++, g++, oC++) storeMagnitude(g->m_h, g->m_v, oC);
+		}
+		for (int y = r.m_y0; y < r.m_y1; y++) {
+			RGBQUAD *oC = out.at<RGBQUAD>(r.m_x0, y);
+			for (int x = r.m_x0; x < r.m_x1; x++, oC++) {
+				oC->rgbBlue = suppress(in, mags, x, y, 0, w, h);
+				oC->rgbGreen = suppress(in, mags, x, y, 1, w, h);
+				oC->rgbRed = suppress(in, mags, x, y, 2, w, h);
+				oC->rgbReserved = 255;
+			}
+		}
+		break;
+	}
+	case Kind::Threshold:
+		for (int y = r.m_y0; y < r.m_y1; y++) {
+			const RGBQUAD *iC = in.at<RGBQUAD>(r.m_x0, y);
+			RGBQUAD *oC = out.at<RGBQUAD>(r.m_x0, y);
+			for (int x = r.m_x0; x < r.m_x1; x++, iC++, oC++) {
+				oC->rgbBlue = (iC->rgbBlue >= s.m_param) ? 255 : 0;
+				oC->rgbGreen = (iC->rgbGreen >= s.m_param) ? 255 : 0;
+				oC->rgbRed = (iC->rgbRed >= s.m_param) ? 255 : 0;
+				oC->rgbReserved = 255;
+			}
+		}
+		break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// each ping-pong buffer is as large as the largest intermediate written into it
+void FilterGraph::allocateStaged(int w, int h, vector<BYTE> buffers[2]) const {
+	size_t sizes[2] = { 0, 0 };
+
+	for (size_t k = 0; k + 1 < m_stages.size(); k++) sizes[k%2] = max(sizes[k%2], pixelSize(m_stages[k])*w*h);
+	buffers[0].resize(sizes[0]);
+	buffers[1].resize(sizes[1]);
+}
+
+////////////////////////////////////////////////////////////////////////
+// every stage is a separate parallel pass writing a whole intermediate image into buffers (see allocateStaged)
+void FilterGraph::runStaged(const fipImage& input, fipImage& output, vector<BYTE> buffers[2]) const {
+	assert(isValid());
+	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getBitsPerPixel() == 32 && output.getBitsPerPixel() == 32);
+
+	const int w = input.getWidth();
+	const int h = input.getHeight();
+	Plane in = { input.getScanLine(0), input.getScanWidth(), 0, 0 };
+
+	for (size_t k = 0; k < m_stages.size(); k++) {
+		const Stage& s = m_stages[k];
+		assert(k + 1 == m_stages.size() || buffers[k%2].size() >= pixelSize(s)*w*h);
+		const Plane out = (k + 1 == m_stages.size()) ? Plane{ output.getScanLine(0), output.getScanWidth(), 0, 0 } : Plane{ buffers[k%2].data(), pixelSize(s)*w, 0, 0 };
+
+		// blocks of rows keep the per-call setup of the stages small
+		const int rows = 16;
+
+		#pragma omp parallel for
+		for (int y = 0; y < h; y += rows) {
+			runStage(s, in, out, { 0, y, w, min(y + rows, h) }, w, h);
+		}
+		in = out;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// all stages of a tile are computed one after another in per-thread buffers;
+// each intermediate covers the tile extended by the radii of the following stages
+void FilterGraph::runFused(const fipImage& input, fipImage& output, int tileSize) const {
+	assert(isValid());
+	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getBitsPerPixel() == 32 && output.getBitsPerPixel() == 32);
+
+	const int w = input.getWidth();
+	const int h = input.getHeight();
+	const int nx = (w + tileSize - 1)/tileSize;
+	const int ny = (h + tileSize - 1)/tileSize;
+	const Plane in0 = { input.getScanLine(0), input.getScanWidth(), 0, 0 };
+	const Plane outN = { output.getScanLine(0), output.getScanWidth(), 0, 0 };
+
+	size_t bufferSize = 0;
+	for (size_t k = 0; k + 1 < m_stages.size(); k++) {
+		const size_t side = tileSize + 2*halo(k);
+		bufferSize = max(bufferSize, pixelSize(m_stages[k])*side*side);
+	}
+
+	#pragma omp parallel
+	{
+		vector<BYTE> buffers[2] = { vector<BYTE>(bufferSize), vector<BYTE>(bufferSize) };
+
+		#pragma omp for schedule(dynamic)
+		for (int t = 0; t < nx*ny; t++) {
+			const int tx = (t%nx)*tileSize, ty = (t/nx)*tileSize;
+			Plane in = in0;
+
+			for (size_t k = 0; k < m_stages.size(); k++) {
+				const Stage& s = m_stages[k];
+				const int e = halo(k);
+				const Region r = { max(tx - e, 0), max(ty - e, 0), min(tx + tileSize + e, w), min(ty + tileSize + e, h) };
+				const Plane out = (k + 1 == m_stages.size()) ? outN : Plane{ buffers[k%2].data(), pixelSize(s)*(r.m_x1 - r.m_x0), r.m_x0, r.m_y0 };
+
+				runStage(s, in, out, r, w, h);
+				in = out;
+			}
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+int FilterGraph::getTileSize(size_t cacheSize) const {
+	int t = 16;
+
+	for (int c = 32; c <= 1024; c *= 2) {
+		size_t bytes = 0;
+		for (size_t k = 0; k + 1 < m_stages.size(); k++) {
+			const size_t side = c + 2*halo(k);
+			bytes += pixelSize(m_stages[k])*side*side;
+		}
+		if (bytes > cacheSize) break;
+		t = c;
+	}
+	return t;
+}
+
+////////////////////////////////////////////////////////////////////////
+// each stage reads its input image and writes its output image
+size_t FilterGraph::getStagedTraffic(int w, int h) const {
+	size_t bytes = 0, inSize = sizeof(RGBQUAD);
+
+	for (const Stage& s : m_stages) {
+		bytes += (inSize + pixelSize(s))*w*h;
+		inSize = pixelSize(s);
+	}
+	return bytes;
+}
+
+////////////////////////////////////////////////////////////////////////
+// each tile reads its input with the halo of all stages and writes its output
+size_t FilterGraph::getFusedTraffic(int w, int h, int tileSize) const {
+	const double side = tileSize + 2*halo(0) + 2*radius(m_stages.front());
+	return (size_t)(sizeof(RGBQUAD)*(double)w*h*(side*side/((double)tileSize*tileSize) + 1));
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include "main.h"
+
+////////////////////////////////////////////////////////////////////////
+// Filter graph: a chain of stages declared with the builder methods, e.g.
+//   FilterGraph().blur(1).gradient(5).nonMaxSuppression().threshold(64)
+// The graph either runs stage by stage over whole images or fuses all stages into one tiled pass,
+// where the intermediates of a tile stay in per-thread buffers and only input and output touch DRAM.
+// All stages read their input with clamp-to-edge borders, so both variants produce the same results.
+class FilterGraph {
+public:
+	enum class Kind { Blur, Gradient, Magnitude, NonMaxSuppression, Threshold };
+
+	struct Stage {
+		Kind m_kind;
+		int m_param;		// blur radius, gradient filter size or threshold
+	};
+
+	// box blur with (2*radius + 1)^2 pixels: image -> image
+	FilterGraph& blur(int radius);
+	// edge filters of size fSize: image -> gradient
+	FilterGraph& gradient(int fSize);
+	// gradient magnitude: gradient -> image
+	FilterGraph& magnitude();
+	// magnitude where it is a maximum along the gradient direction, 0 elsewhere: gradient -> image
+	FilterGraph& nonMaxSuppression();
+	// 255 for values >= t, 0 elsewhere: image -> image
+	FilterGraph& threshold(int t);
+
+	// the stages form a chain from an image to an image
+	bool isValid() const;
+
+	// intermediate images of runStaged on w x h images: stage k writes into buffers[k%2], the last stage into the output
+	void allocateStaged(int w, int h, vector<BYTE> buffers[2]) const;
+	void runStaged(const fipImage& input, fipImage& output, vector<BYTE> buffers[2]) const;
+	void runFused(const fipImage& input, fipImage& output, int tileSize) const;
+
+	// largest square tile whose intermediates fit into cacheSize bytes
+	int getTileSize(size_t cacheSize) const;
+	// DRAM traffic in bytes of a model without cache reuse between the passes or tiles
+	size_t getStagedTraffic(int w, int h) const;
+	size_t getFusedTraffic(int w, int h, int tileSize) const;
+
+private:
+	vector<Stage> m_stages;
+
+	// border pixels a stage needs around its output
+	static int radius(const Stage& s);
+	// bytes per pixel of the output of a stage
+	static size_t pixelSize(const Stage& s);
+	// border pixels of stage k's output needed by the following stages
+	int halo(size_t k) const;
+};
@@ -0,0 +1,34 @@
+#include "magnitude.h"
+
+////////////////////////////////////////////////////////////////////////
+SqrtTable::SqrtTable() {
+	for (int d = 0; d < 255; d++) {
+		for (int n = d*d; n < (d + 1)*(d + 1); n++) m_root[n] = (BYTE)d;
+	}
+}
+
+const SqrtTable g_sqrtTable;
+
+#ifndef NDEBUG
+#include <climits>
+
+////////////////////////////////////////////////////////////////////////
+// storeMagnitude must agree with magnitude also where the SSE2 version saturates to 16 bit
+static bool checkMagnitudeLimits() {
+	const int values[] = { INT_MIN + 1, -40000, -32769, -32768, -32767, -256, -255, -1, 0, 1, 255, 256, 32767, 32768, 40000, INT_MAX };
+
+	for (int x: values) {
+		for (int y: values) {
+			const int hC[3] = { x, y, x };
+			const int vC[3] = { y, x, x };
+			RGBQUAD oC;
+
+			storeMagnitude(hC, vC, &oC);
+			if (oC.rgbBlue != magnitude(x, y) || oC.rgbGreen != magnitude(y, x) || oC.rgbRed != magnitude(x, x) || oC.rgbReserved != 255) return false;
+		}
+	}
+	return true;
+}
+
+static const bool magnitudeLimitsChecked = (assert(checkMagnitudeLimits()), true);
+#endif
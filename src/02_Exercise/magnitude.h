@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdlib>
+#include <algorithm>
+#include "main.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Gradient magnitude min((int)sqrtf(x*x + y*y), 255) without a square root per channel.
+// Everything with x*x + y*y >= 255*255 saturates, the remaining range is a table lookup.
+// For n < 255*255 the truncated float square root is the exact integer square root,
+// so both the table and the SSE2 version are bit-identical to the sqrtf version.
+
+const int MagnitudeLimit = 255*255;
+
+// integer square roots of [0, 255*255)
+struct SqrtTable {
+	BYTE m_root[MagnitudeLimit];
+	SqrtTable();
+};
+
+extern const SqrtTable g_sqrtTable;
+
+////////////////////////////////////////////////////////////////////////
+inline BYTE magnitude(int x, int y) {
+	// |x| or |y| >= 255 saturates anyway; clamping keeps x*x + y*y in range for large filters
+	x = min(abs(x), 255);
+	y = min(abs(y), 255);
+	const int n = x*x + y*y;
+	return (n >= MagnitudeLimit) ? 255 : g_sqrtTable.m_root[n];
+}
+
+////////////////////////////////////////////////////////////////////////
+// writes the magnitudes of the three channels and alpha = 255
+inline void storeMagnitude(const int hC[3], const int vC[3], RGBQUAD *oC) {
+#ifdef USE_SSE2
+	// saturating to 16 bit and clamping to [-255, 255] keeps the sum of squares in 32 bit as in magnitude,
+	// since 2*32768^2 would wrap around; one square root for all channels
+	const __m128i limit = _mm_set1_epi16(255);
+	const __m128i h = _mm_setr_epi32(hC[0], hC[1], hC[2], 0);
+	const __m128i v = _mm_setr_epi32(vC[0], vC[1], vC[2], 0);
+	const __m128i h16 = _mm_max_epi16(_mm_min_epi16(_mm_packs_epi32(h, h), limit), _mm_sub_epi16(_mm_setzero_si128(), limit));
+	const __m128i v16 = _mm_max_epi16(_mm_min_epi16(_mm_packs_epi32(v, v), limit), _mm_sub_epi16(_mm_setzero_si128(), limit));
+	const __m128i hv = _mm_unpacklo_epi16(h16, v16);
+	const __m128 n = _mm_min_ps(_mm_cvtepi32_ps(_mm_madd_epi16(hv, hv)), _mm_set1_ps((float)MagnitudeLimit));
+	const __m128i d = _mm_cvttps_epi32(_mm_sqrt_ps(n));
+	const __m128i d8 = _mm_packus_epi16(_mm_packs_epi32(d, d), d);
+	*reinterpret_cast<int*>(oC) = _mm_cvtsi128_si32(d8) | 0xFF000000;
+#else
+	oC->rgbBlue = magnitude(hC[0], vC[0]);
+	oC->rgbGreen = magnitude(hC[1], vC[1]);
+	oC->rgbRed = magnitude(hC[2], vC[2]);
+	oC->rgbReserved = 255;
+#endif
+}
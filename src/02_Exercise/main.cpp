@@ -1,75 +1,165 @@
+#include <cstring>
+#include <vector>
+#include <functional>
+#include <omp.h>
 #include "main.h"
+#include "magnitude.h"
 #include "ocl.h"
+#include "filters.h"
+#include "rawimage.h"
+#include "filtergraph.h"
+#include "PerfCounter.h"
 
 ////////////////////////////////////////////////////////////////////////
 // prototypes
-OCLData initOCL(const char* kernelFileName, const char* kernelName);
-void processOCL(OCLData& ocl, const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize);
+OCLData initOCL(const char* kernelFileName, const char* kernelName, const char* device);
+vector<OCLData> initOCLDevices(const char* kernelFileName, const char* kernelName, const char* device);
+void printProfile(const OCLData& ocl);
+void processOCLBatch(OCLData& ocl, const vector<const fipImage*>& inputs, const vector<fipImage*>& outputs, const int *hFilter, const int *vFilter, int fSize, Border border);
+void processOCL(OCLData& ocl, const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize, Border border);
+void processOCL(OCLData& ocl, const BYTE *input, BYTE *output, size_t w, size_t h, size_t stride, const int *hFilter, const int *vFilter, int fSize, Border border);
+bool processSeparable(const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize, Border border);
+bool processPlanar(const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize, Border border);
+bool processPlanar(const BYTE *input, BYTE *output, int w, int h, size_t stride, const int *hFilter, const int *vFilter, int fSize, Border border);
+void processRunningSum(const fipImage& input, fipImage& output, int fSize, Border border);
+bool processTyped(const fipImage& input, fipImage& output, int fSize, Border border);
+size_t getL2CacheSize();
+void getTileSize(size_t cacheSize, int fSize, int& tileW, int& tileH);
+bool processBatch(const char* input, const char* outDir, const ImageFilter& filter, int fSize, Border border, int decoders, int filterThreads, int encoders);
+bool processStreaming(const char* inName, const char* outName, int fSize, int stripHeight, const ImageFilter& filter);
+void processSplit(vector<OCLData>& devices, const RawFilter& hostFilter, const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize, Border border, const vector<double>& shares);
+vector<double> calibrateSplit(vector<OCLData>& devices, const RawFilter& hostFilter, const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize, Border border);
 
 ////////////////////////////////////////////////////////////////////////
-static BYTE dist(int x, int y) {
-	int d = (int)sqrtf((float)(x*x) + (float)(y*y));
-	return (d < 256) ? d : 255;
+// specialized for each filter size: the filter taps are compile-time constants (see Convolution);
+// input and output are w x h BGRA images with scanlines of stride bytes, e.g. memory mapped raw images
+template<int FSize>
+static void processParallel(const BYTE *input, BYTE *output, int w, int h, size_t stride, Border border) {
+	const int bypp = 4;
+	const int fSizeD2 = FSize/2;
+
+	#pragma omp parallel for
+	for(int v = fSizeD2; v < h - fSizeD2; v++) {
+		const BYTE *iPos = input + (v - fSizeD2)*stride;
+		BYTE *oPos = output + v*stride + bypp*fSizeD2;
+
+		for(int u = fSizeD2; u < w - fSizeD2; u++) {
+			int hC[3] = { 0, 0, 0 };
+			int vC[3] = { 0, 0, 0 };
+
+			Convolution<FSize>::apply(iPos, stride, hC, vC);
+
+			RGBQUAD *oC = reinterpret_cast<RGBQUAD*>(oPos);
+			storeMagnitude(hC, vC, oC);
+			iPos += bypp;
+			oPos += bypp;
+		}
+	}
+	processBorder(input, output, w, h, stride, EdgeFilter<FSize>::tables.h, EdgeFilter<FSize>::tables.v, FSize, border);
+}
+
+////////////////////////////////////////////////////////////////////////
+template<int FSize>
+static void processParallel(const fipImage& input, fipImage& output, Border border) {
+	const int bypp = 4;
+	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
+	assert(input.getBitsPerPixel() == bypp*8);
+
+	processParallel<FSize>(input.getScanLine(0), output.getScanLine(0), input.getWidth(), input.getHeight(), input.getScanWidth(), border);
 }
 
 ////////////////////////////////////////////////////////////////////////
-static void processParallel(const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize) {
+// cache-blocked version of processParallel: the image is split into tileW x tileH tiles,
+// which are distributed dynamically; each tile reads its input with a halo of fSize/2 pixels
+template<int FSize>
+static void processTiled(const fipImage& input, fipImage& output, int tileW, int tileH, Border border) {
 	const int bypp = 4;
 	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
 	assert(input.getBitsPerPixel() == bypp*8);
 
 	const size_t stride = input.getScanWidth();
-	const int fSizeD2 = fSize/2;
+	const int fSizeD2 = FSize/2;
+	const int w = output.getWidth() - 2*fSizeD2;
+	const int h = output.getHeight() - 2*fSizeD2;
 
-	#pragma omp parallel for
-	for(int v = fSizeD2; v < (int)output.getHeight() - fSizeD2; v++) {
-		BYTE *iCenter = input.getScanLine(v) + bypp*fSizeD2;
-		BYTE *oPos = output.getScanLine(v) + bypp*fSizeD2;
+	processBorder(input, output, EdgeFilter<FSize>::tables.h, EdgeFilter<FSize>::tables.v, FSize, border);
+	if (w <= 0 || h <= 0) return;
 
-		for(size_t u = fSizeD2; u < output.getWidth() - fSizeD2; u++) {
-			int hC[3] = { 0, 0, 0 };
-			int vC[3] = { 0, 0, 0 };
-			int fi = 0;
-			BYTE *iPos = iCenter - fSizeD2*stride - bypp*fSizeD2;
-
-			for(int j = 0; j < fSize; j++) {
-				for(int i = 0; i < fSize; i++) {
-					const RGBQUAD *iC = reinterpret_cast<RGBQUAD*>(iPos);
-					int f = hFilter[fi];
-
-					hC[0] += f*iC->rgbBlue;
-					hC[1] += f*iC->rgbGreen;
-					hC[2] += f*iC->rgbRed;
-					f = vFilter[fi];
-					vC[0] += f*iC->rgbBlue;
-					vC[1] += f*iC->rgbGreen;
-					vC[2] += f*iC->rgbRed;
-					iPos += bypp;
-					fi++;
-				}
-				iPos += stride - bypp*fSize;
+	const int nx = (w + tileW - 1)/tileW;
+	const int ny = (h + tileH - 1)/tileH;
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int t = 0; t < nx*ny; t++) {
+		const int u0 = fSizeD2 + (t%nx)*tileW, u1 = min(u0 + tileW, fSizeD2 + w);
+		const int v0 = fSizeD2 + (t/nx)*tileH, v1 = min(v0 + tileH, fSizeD2 + h);
+
+		for(int v = v0; v < v1; v++) {
+			const BYTE *iPos = input.getScanLine(v - fSizeD2) + bypp*(u0 - fSizeD2);
+			RGBQUAD *oC = reinterpret_cast<RGBQUAD*>(output.getScanLine(v)) + u0;
+
+			for(int u = u0; u < u1; u++, oC++) {
+				int hC[3] = { 0, 0, 0 };
+				int vC[3] = { 0, 0, 0 };
+
+				Convolution<FSize>::apply(iPos, stride, hC, vC);
+
+				storeMagnitude(hC, vC, oC);
+				iPos += bypp;
 			}
-			RGBQUAD *oC = reinterpret_cast<RGBQUAD*>(oPos);
-			oC->rgbBlue = dist(hC[0], vC[0]);
-			oC->rgbGreen = dist(hC[1], vC[1]);
-			oC->rgbRed = dist(hC[2], vC[2]);
-			oC->rgbReserved = 255;
-			iCenter += bypp;
-			oPos += bypp;
 		}
 	}
 }
 
 ////////////////////////////////////////////////////////////////////////
-static bool equals(const fipImage& im1, const fipImage& im2, int fSize) {
+// filter tables and specialized OpenMP kernels per filter size
+struct FilterEntry {
+	const int *hFilter;
+	const int *vFilter;
+	void (*processParallel)(const fipImage& input, fipImage& output, Border border);
+	void (*processTiled)(const fipImage& input, fipImage& output, int tileW, int tileH, Border border);
+	void (*processRaw)(const BYTE *input, BYTE *output, int w, int h, size_t stride, Border border);
+};
+
+static const FilterEntry filterEntries[] = {
+	{ EdgeFilter<3>::tables.h, EdgeFilter<3>::tables.v, processParallel<3>, processTiled<3>, processParallel<3> },
+	{ EdgeFilter<5>::tables.h, EdgeFilter<5>::tables.v, processParallel<5>, processTiled<5>, processParallel<5> },
+	{ EdgeFilter<7>::tables.h, EdgeFilter<7>::tables.v, processParallel<7>, processTiled<7>, processParallel<7> },
+	{ EdgeFilter<9>::tables.h, EdgeFilter<9>::tables.v, processParallel<9>, processTiled<9>, processParallel<9> },
+	{ EdgeFilter<11>::tables.h, EdgeFilter<11>::tables.v, processParallel<11>, processTiled<11>, processParallel<11> },
+};
+
+////////////////////////////////////////////////////////////////////////
+// output image with the pixel format and shape of image: the pixels are not copied, because the filters write all of them
+static fipImage makeOutput(const fipImage& image) {
+	return fipImage(image.getImageType(), image.getWidth(), image.getHeight(), image.getBitsPerPixel());
+}
+
+////////////////////////////////////////////////////////////////////////
+// fills dst with copies of src
+static void repeatImage(const fipImage& src, fipImage& dst) {
+	const unsigned int bypp = 4;
+	assert(src.getBitsPerPixel() == bypp*8 && dst.getBitsPerPixel() == bypp*8);
+
+	for(unsigned int v = 0; v < dst.getHeight(); v++) {
+		const BYTE *iPos = src.getScanLine(v%src.getHeight());
+		BYTE *oPos = dst.getScanLine(v);
+
+		for(unsigned int u = 0; u < dst.getWidth(); u += src.getWidth()) {
+			memcpy(oPos + bypp*u, iPos, bypp*min(src.getWidth(), dst.getWidth() - u));
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// compares all pixels including the border
+static bool equals(const fipImage& im1, const fipImage& im2) {
 	assert(im1.getWidth() == im2.getWidth() && im1.getHeight() == im2.getHeight() && im1.getImageSize() == im2.getImageSize());
 	assert(im1.getBitsPerPixel() == 32);
-	const int fSizeD2 = fSize/2;
 
-	for(unsigned int i = fSizeD2; i < im1.getHeight() - fSizeD2; i++) {
+	for(unsigned int i = 0; i < im1.getHeight(); i++) {
 		COLORREF *row1 = reinterpret_cast<COLORREF*>(im1.getScanLine(i));
 		COLORREF *row2 = reinterpret_cast<COLORREF*>(im2.getScanLine(i));
-		for(unsigned int j = fSizeD2; j < im1.getWidth() - fSizeD2; j++) {
+		for(unsigned int j = 0; j < im1.getWidth(); j++) {
 			if (row1[j] != row2[j]) return false;
 		}
 	}
@@ -77,16 +167,376 @@ static bool equals(const fipImage& im1, const fipImage& im2, int fSize) {
 }
 
 ////////////////////////////////////////////////////////////////////////
-int main(int argc, const char* argv[]) {
+// DRAM traffic measured as last level cache misses of 64 byte cache lines
+static string measuredTraffic(const PerfCounter& counter) {
+	if (counter.GetCount() < 0) return "not available";
+	return to_string(64*counter.GetCount()/(1024*1024)) + " MB";
+}
+
+////////////////////////////////////////////////////////////////////////
+static bool parseBorder(const char* name, Border& border) {
+	const string s(name);
+
+	if (s == "clamp") border = Border::Clamp;
+	else if (s == "mirror") border = Border::Mirror;
+	else if (s == "wrap") border = Border::Wrap;
+	else if (s == "zero") border = Border::Zero;
+	else return false;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// fastest CPU filter for the given filter size or the planar filter;
+// the planar filter falls back to the specialized filter if the filter responses exceed 16 bit
+static ImageFilter makeFilter(int fSize, Border border, bool planar) {
+	if (fSize > 11) {
+		return [fSize, border](const fipImage& input, fipImage& output) { processRunningSum(input, output, fSize, border); };
+	} else if (planar) {
+		const FilterEntry *entry = &filterEntries[(fSize - 3)/2];
+		return [entry, fSize, border](const fipImage& input, fipImage& output) {
+			if (!processPlanar(input, output, entry->hFilter, entry->vFilter, fSize, border)) entry->processParallel(input, output, border);
+		};
+	} else {
+		return [fSize, border](const fipImage& input, fipImage& output) { filterEntries[(fSize - 3)/2].processParallel(input, output, border); };
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// makeFilter for raw images with a filter table
+static RawFilter makeRawFilter(int fSize, Border border, bool planar) {
+	assert(fSize <= 11);
+	const FilterEntry *entry = &filterEntries[(fSize - 3)/2];
+
+	if (planar) {
+		return [entry, fSize, border](const BYTE *input, BYTE *output, int w, int h, size_t stride) {
+			if (!processPlanar(input, output, w, h, stride, entry->hFilter, entry->vFilter, fSize, border)) entry->processRaw(input, output, w, h, stride, border);
+		};
+	} else {
+		return [entry, border](const BYTE *input, BYTE *output, int w, int h, size_t stride) { entry->processRaw(input, output, w, h, stride, border); };
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// batch mode: pipelined edge detection of all images of a directory or file list
+static int batch(int argc, const char* argv[], bool planar) {
+	if (argc < 5) {
+		cerr << "Usage: " << argv[0] << " [-planar] -batch filter-size input-directory|file-list output-directory [decode-threads filter-threads encode-threads]" << endl;
+		return -1;
+	}
+	const int fSize = atoi(argv[2]);
+	if (fSize < 3 || (fSize & 1) == 0) {
+		cerr << "Wrong filter size. Filter size must be odd and at least 3" << endl;
+		return -2;
+	}
+	const int decoders = (argc > 5) ? max(atoi(argv[5]), 1) : 2;
+	const int filterThreads = (argc > 6) ? max(atoi(argv[6]), 1) : omp_get_num_procs();
+	const int encoders = (argc > 7) ? max(atoi(argv[7]), 1) : 2;
+
+	cout << "Batch " << (planar ? "planar " : "") << "edge detection with filter size " << fSize << endl;
+	return processBatch(argv[3], argv[4], makeFilter(fSize, Border::Clamp, planar), fSize, Border::Clamp, decoders, filterThreads, encoders) ? 0 : -3;
+}
+
+////////////////////////////////////////////////////////////////////////
+// streaming mode: strip by strip edge detection of a binary PPM with bounded memory
+static int stream(int argc, const char* argv[], bool planar) {
+	if (argc < 5) {
+		cerr << "Usage: " << argv[0] << " [-planar] -stream filter-size input-ppm output-ppm [strip-height] [clamp|mirror|zero]" << endl;
+		return -1;
+	}
+	const int fSize = atoi(argv[2]);
+	if (fSize < 3 || (fSize & 1) == 0) {
+		cerr << "Wrong filter size. Filter size must be odd and at least 3" << endl;
+		return -2;
+	}
+	const int stripHeight = (argc > 5) ? max(atoi(argv[5]), 1) : 256;
+	Border border = Border::Clamp;
+	if (argc > 6 && (!parseBorder(argv[6], border) || border == Border::Wrap)) {
+		cerr << "Wrong border mode: " << argv[6] << endl;
+		return -4;
+	}
+
+	Stopwatch sw;
+	cout << "Streaming " << (planar ? "planar " : "") << "edge detection with filter size " << fSize << endl;
+	sw.Start();
+	const bool ok = processStreaming(argv[3], argv[4], fSize, stripHeight, makeFilter(fSize, border, planar));
+	sw.Stop();
+	cout << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
+	return ok ? 0 : -3;
+}
+
+////////////////////////////////////////////////////////////////////////
+static bool hasRawExtension(const string& fileName) {
+	return fileName.size() > 5 && fileName.compare(fileName.size() - 5, 5, ".bgra") == 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// conversion between FreeImage formats and raw image files (.bgra)
+static int convert(int argc, const char* argv[]) {
+	if (argc < 4 || hasRawExtension(argv[2]) == hasRawExtension(argv[3])) {
+		cerr << "Usage: " << argv[0] << " -convert image-file raw-file.bgra | raw-file.bgra image-file" << endl;
+		return -1;
+	}
+	fipImage image;
+
+	if (hasRawExtension(argv[3])) {
+		if (!image.load(argv[2])) {
+			cerr << "Image not found: " << argv[2] << endl;
+			return -3;
+		}
+		if (!saveRawImage(image, argv[3])) {
+			cerr << "Image not saved: " << argv[3] << endl;
+			return -3;
+		}
+	} else {
+		if (!loadRawImage(argv[2], image)) {
+			cerr << "Raw image not found: " << argv[2] << endl;
+			return -3;
+		}
+		if (!image.save(argv[3])) {
+			cerr << "Image not saved: " << argv[3] << endl;
+			return -3;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// edge detection on memory mapped raw image files without decoding and copying
+static int raw(int argc, const char* argv[], bool planar) {
+	if (argc < 5) {
+		cerr << "Usage: " << argv[0] << " [-planar] -raw filter-size input-file.bgra output-file.bgra [clamp|mirror|wrap|zero] [gpu|cpu|accelerator|all|device-index|device-name]" << endl;
+		return -1;
+	}
+	const int fSize = atoi(argv[2]);
+	if (fSize < 3 || fSize > 11 || (fSize & 1) == 0) {
+		cerr << "Wrong filter size. Filter size must be odd and between 3 and 11" << endl;
+		return -2;
+	}
+	Border border = Border::Clamp;
+	if (argc > 5 && !parseBorder(argv[5], border)) {
+		cerr << "Wrong border mode: " << argv[5] << endl;
+		return -4;
+	}
+
+	Stopwatch sw;
+	RawImage input, output;
+	const FilterEntry& filter = filterEntries[(fSize - 3)/2];
+	const RawFilter rawFilter = makeRawFilter(fSize, border, planar);
+
+	sw.Start();
+	if (!input.open(argv[3])) {
+		cerr << "Raw image not found: " << argv[3] << endl;
+		return -3;
+	}
+	sw.Stop();
+	cout << "Mapped " << input.getWidth() << " x " << input.getHeight() << " raw image in " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
+
+	if (!output.create(argv[4], input.getWidth(), input.getHeight())) {
+		cerr << "Image not saved: " << argv[4] << endl;
+		return -3;
+	}
+	const int w = input.getWidth();
+	const int h = input.getHeight();
+	const size_t stride = input.getStride();
+
+	cout << "Edge detection with filter size " << fSize << endl << endl;
+	cout << "Start " << (planar ? "planar " : "") << "OpenMP" << endl;
+	sw.Start();
+	rawFilter(input.getBits(), output.getBits(), w, h, stride);
+	sw.Stop();
+	const double parTime = sw.GetElapsedTimeMilliseconds();
+	cout << parTime << " ms" << endl << endl;
+
+	// OpenCL writes into a host buffer with the same layout
+	vector<BYTE> out2(stride*h);
+	OCLData ocl = initOCL("..\\02_Exercise\\edges.cl", "edges", (argc > 6) ? argv[6] : nullptr);
+	cout << endl << "Start OpenCL on " << ocl.m_deviceName << endl;
+	sw.Start();
+	processOCL(ocl, input.getBits(), out2.data(), w, h, stride, filter.hFilter, filter.vFilter, fSize, border);
+	sw.Stop();
+	cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << parTime/sw.GetElapsedTimeMilliseconds() << endl;
+	printProfile(ocl);
+
+	bool same = true;
+	for (int v = 0; v < h && same; v++) same = memcmp(output.getScanLine(v), out2.data() + v*stride, 4*(size_t)w) == 0;
+	cout << boolalpha << "OpenMP and OpenCL produce the same results: " << same << endl;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// benchmark mode: the CPU filters on an 8K image made of copies of the input image
+static int bench(int argc, const char* argv[]) {
 	if (argc < 4) {
-		cerr << "Usage: " << argv[0] << " filter-size input-file-name output-file-name" << endl;
+		cerr << "Usage: " << argv[0] << " -bench filter-size input-file-name [clamp|mirror|wrap|zero]" << endl;
 		return -1;
 	}
-	int fSize = atoi(argv[1]);
+	const int fSize = atoi(argv[2]);
 	if (fSize < 3 || fSize > 11 || (fSize & 1) == 0) {
-		cerr << "Wrong filter size. Filter size must be odd and between 3 and 9" << endl;
+		cerr << "Wrong filter size. Filter size must be odd and between 3 and 11" << endl;
+		return -2;
+	}
+	Border border = Border::Clamp;
+	if (argc > 4 && !parseBorder(argv[4], border)) {
+		cerr << "Wrong border mode: " << argv[4] << endl;
+		return -4;
+	}
+
+	fipImage image;
+	if (!image.load(argv[3])) {
+		cerr << "Image not found: " << argv[3] << endl;
+		return -3;
+	}
+	if ((image.getImageType() != FIT_BITMAP || image.getBitsPerPixel() != 32) && !image.convertTo32Bits()) {
+		cerr << "Pixel format not supported" << endl;
+		return -2;
+	}
+
+	Stopwatch sw;
+	const FilterEntry& filter = filterEntries[(fSize - 3)/2];
+	fipImage out = makeOutput(image);
+
+	cout << "Benchmarks with filter size " << fSize << endl << endl;
+
+	// cache-blocked tiles on an 8K image
+	fipImage large(FIT_BITMAP, 7680, 4320, 32);
+	repeatImage(image, large);
+	{
+		int tileW, tileH;
+		const size_t cacheSize = getL2CacheSize();
+		getTileSize(cacheSize, fSize, tileW, tileH);
+
+		// copying the input into an output reads and writes every pixel, which the filter overwrites anyway
+		sw.Start();
+		{
+			fipImage copy1(large), copy2(large);
+		}
+		sw.Stop();
+		const double copyTime = sw.GetElapsedTimeMilliseconds();
+		sw.Start();
+		{
+			fipImage alloc1 = makeOutput(large), alloc2 = makeOutput(large);
+		}
+		sw.Stop();
+		cout << "Two 8K output images: copied " << copyTime << " ms, allocated " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
+
+		fipImage outRows = makeOutput(large), outTiles = makeOutput(large);
+
+		cout << "Start OpenMP on 8K image" << endl;
+		sw.Start();
+		filter.processParallel(large, outRows, border);
+		sw.Stop();
+		const double rowTime = sw.GetElapsedTimeMilliseconds();
+		cout << rowTime << " ms" << endl;
+
+		cout << "Start tiled OpenMP on 8K image (L2 " << cacheSize/1024 << " KB, tiles " << tileW << "x" << tileH << ")" << endl;
+		sw.Start();
+		filter.processTiled(large, outTiles, tileW, tileH, border);
+		sw.Stop();
+		cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << rowTime/sw.GetElapsedTimeMilliseconds() << endl;
+		cout << boolalpha << "OpenMP and tiled OpenMP produce the same results: " << equals(outRows, outTiles) << endl << endl;
+
+		// interleaved BGRA kernels against the planar kernel for all filter sizes
+		cout << "Interleaved and planar OpenMP on 8K image" << endl;
+		for (const FilterEntry& entry: filterEntries) {
+			const int size = (int)(&entry - filterEntries)*2 + 3;
+
+			sw.Start();
+			entry.processParallel(large, outRows, border);
+			sw.Stop();
+			const double aosTime = sw.GetElapsedTimeMilliseconds();
+			sw.Start();
+			processPlanar(large, outTiles, entry.hFilter, entry.vFilter, size, border);
+			sw.Stop();
+			cout << "filter size " << size << ": interleaved " << aosTime << " ms, planar " << sw.GetElapsedTimeMilliseconds() << " ms, speedup = "
+				<< aosTime/sw.GetElapsedTimeMilliseconds() << ", same results: " << boolalpha << equals(outRows, outTiles) << endl;
+		}
+		cout << endl;
+	}
+
+	// blur, gradient, non-maximum suppression and threshold on an 8K image: stage by stage and fused into one tiled pass;
+	// the DRAM traffic is measured with the last level cache misses and compared with the traffic model of the graph
+	{
+		FilterGraph graph;
+		graph.blur(1).gradient(fSize).nonMaxSuppression().threshold(64);
+
+		const int w = large.getWidth(), h = large.getHeight();
+		const int tileSize = graph.getTileSize(getL2CacheSize());
+		const double MB = 1024*1024;
+		fipImage outStaged = makeOutput(large), outFused = makeOutput(large);
+		vector<BYTE> buffers[2];
+		PerfCounter llcMisses(PerfCounter::Event::CacheMisses);
+
+		graph.allocateStaged(w, h, buffers);
+		cout << "Start staged filter graph on 8K image (model traffic " << graph.getStagedTraffic(w, h)/MB << " MB)" << endl;
+		llcMisses.Start();
+		sw.Start();
+		graph.runStaged(large, outStaged, buffers);
+		sw.Stop();
+		llcMisses.Stop();
+		const double stagedTime = sw.GetElapsedTimeMilliseconds();
+		const int64_t stagedMisses = llcMisses.GetCount();
+		cout << stagedTime << " ms, measured traffic " << measuredTraffic(llcMisses) << endl;
+
+		cout << "Start fused filter graph on 8K image (tiles " << tileSize << "x" << tileSize << ", model traffic " << graph.getFusedTraffic(w, h, tileSize)/MB << " MB)" << endl;
+		llcMisses.Start();
+		sw.Start();
+		graph.runFused(large, outFused, tileSize);
+		sw.Stop();
+		llcMisses.Stop();
+		cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << stagedTime/sw.GetElapsedTimeMilliseconds() << ", measured traffic " << measuredTraffic(llcMisses);
+		if (stagedMisses >= 0 && llcMisses.GetCount() >= 0) cout << ", reduction = " << (double)stagedMisses/max<int64_t>(llcMisses.GetCount(), 1);
+		cout << endl;
+		cout << boolalpha << "Staged and fused filter graph produce the same results: " << equals(outStaged, outFused) << endl << endl;
+	}
+
+	// the running-sum filter is independent of the filter size
+	cout << "Running-sum benchmark" << endl;
+	for (int k = 3; k <= 129; k = 2*k - 1) {
+		sw.Start();
+		processRunningSum(image, out, k, border);
+		sw.Stop();
+		cout << "filter size " << k << ": " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
+	}
+	cout << endl;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+int main(int argc, const char* argv[]) {
+	// -planar in front of a mode selects the planar filter: it is removed from the arguments of the mode
+	const bool planar = argc > 2 && string(argv[1]) == "-planar";
+	if (planar) {
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
+	if (argc > 1 && string(argv[1]) == "-batch") return batch(argc, argv, planar);
+	if (argc > 1 && string(argv[1]) == "-stream") return stream(argc, argv, planar);
+	if (argc > 1 && string(argv[1]) == "-convert") return convert(argc, argv);
+	if (argc > 1 && string(argv[1]) == "-raw") return raw(argc, argv, planar);
+	if (argc > 1 && string(argv[1]) == "-bench" && !planar) return bench(argc, argv);
+	if (argc < 4 || planar) {
+		cerr << "Usage: " << argv[0] << " filter-size input-file-name output-file-name [clamp|mirror|wrap|zero] [gpu|cpu|accelerator|all|device-index|device-name]" << endl;
+		cerr << "       " << argv[0] << " [-planar] -batch filter-size input-directory|file-list output-directory [decode-threads filter-threads encode-threads]" << endl;
+		cerr << "       " << argv[0] << " [-planar] -stream filter-size input-ppm output-ppm [strip-height] [clamp|mirror|zero]" << endl;
+		cerr << "       " << argv[0] << " -convert image-file raw-file.bgra | raw-file.bgra image-file" << endl;
+		cerr << "       " << argv[0] << " [-planar] -raw filter-size input-file.bgra output-file.bgra [clamp|mirror|wrap|zero] [gpu|cpu|accelerator|all|device-index|device-name]" << endl;
+		cerr << "       " << argv[0] << " -bench filter-size input-file-name [clamp|mirror|wrap|zero]" << endl;
+		cerr << "       -planar selects the planar filter of the filter sizes 3 to 11, the default mode compares it with the other filters" << endl;
+		cerr << "       the OpenCL device can also be selected with the environment variable OCL_DEVICE, by default the GPUs are used" << endl;
+		return -1;
+	}
+	int fSize = atoi(argv[1]);
+	if (fSize < 3 || (fSize & 1) == 0) {
+		cerr << "Wrong filter size. Filter size must be odd and at least 3" << endl;
 		return -2;
 	}
+	Border border = Border::Clamp;
+	if (argc > 4 && !parseBorder(argv[4], border)) {
+		cerr << "Wrong border mode: " << argv[4] << endl;
+		return -4;
+	}
+	const char* device = (argc > 5) ? argv[5] : nullptr;
 
 	fipImage image;
 
@@ -96,148 +546,166 @@ int main(int argc, const char* argv[]) {
 		return -3;
 	}
 
-	const int hFilter3[] = {
-		1, 1, 1,
-		0, 0, 0,
-	   -1,-1,-1,
-	};
-	const int vFilter3[] = {
-		1, 0,-1,
-		1, 0,-1,
-		1, 0,-1,
-	};
-	const int hFilter5[] = {
-		0, 0, 0, 0, 0,
-		1, 1, 1, 1, 1,
-		0, 0, 0, 0, 0,
-	   -1,-1,-1,-1,-1,
-	    0, 0, 0, 0, 0,
-	};
-	const int vFilter5[] = {
-		0, 1, 0,-1, 0,
-		0, 1, 0,-1, 0,
-		0, 1, 0,-1, 0,
-		0, 1, 0,-1, 0,
-		0, 1, 0,-1, 0,
-	};
-	const int hFilter7[] = {
-		0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0,
-		1, 1, 1, 1, 1, 1, 1,
-		0, 0, 0, 0, 0, 0, 0,
-	   -1,-1,-1,-1,-1,-1,-1,
-	    0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0,
-	};
-	const int vFilter7[] = {
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-	};
-	const int hFilter9[] = {
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-		1, 1, 1, 1, 1, 1, 1, 1, 1,
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-	   -1,-1,-1,-1,-1,-1,-1,-1,-1,
-	    0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-	};
-	const int vFilter9[] = {
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-	};
-	const int hFilter11[] = {
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-	    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	};
-	const int vFilter11[] = {
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-	};
+	if (image.getImageType() != FIT_BITMAP || image.getBitsPerPixel() != 32) {
+		// 24 bit, 16 bit and float images are filtered in their own pixel format
+		Stopwatch sw;
+		fipImage out = makeOutput(image);
 
-	Stopwatch sw;
-	double parTime;
-	const int *hFilter;
-	const int *vFilter;
+		cout << "Edge detection with filter size " << fSize << " on " << image.getBitsPerPixel() << " bit image" << endl << endl;
+		cout << "Start typed OpenMP" << endl;
+		sw.Start();
+		if (!processTyped(image, out, fSize, border)) {
+			cerr << "Pixel format or filter size not supported" << endl;
+			return -2;
+		}
+		sw.Stop();
+		cout << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
 
-	switch(fSize) {
-	case 3:
-		hFilter = hFilter3;
-		vFilter = vFilter3;
-		break;
-	case 5:
-		hFilter = hFilter5;
-		vFilter = vFilter5;
-		break;
-	case 7:
-		hFilter = hFilter7;
-		vFilter = vFilter7;
-		break;
-	case 9:
-		hFilter = hFilter9;
-		vFilter = vFilter9;
-		break;
-	case 11:
-		hFilter = hFilter11;
-		vFilter = vFilter11;
-		break;
+		const string outName = "OpenMP_" + string(argv[3]);
+		if (!out.save(outName.c_str())) {
+			cerr << "Image not saved: " << outName << endl;
+		}
+		return 0;
 	}
 
+	if (fSize > 11) {
+		// only the running-sum filter supports filter sizes without filter tables
+		Stopwatch sw;
+		fipImage out = makeOutput(image);
+
+		cout << "Edge detection with filter size " << fSize << endl << endl;
+		cout << "Start running-sum OpenMP" << endl;
+		sw.Start();
+		processRunningSum(image, out, fSize, border);
+		sw.Stop();
+		cout << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
+
+		const string outName = "RunningSum_" + string(argv[3]);
+		if (!out.save(outName.c_str())) {
+			cerr << "Image not saved: " << outName << endl;
+		}
+		return 0;
+	}
+
+	Stopwatch sw;
+	double parTime;
+	const FilterEntry& filter = filterEntries[(fSize - 3)/2];
+	const int *hFilter = filter.hFilter;
+	const int *vFilter = filter.vFilter;
+
 	// create output images
-	fipImage out1(image), out2(image);
+	fipImage out1 = makeOutput(image), out2 = makeOutput(image), out3 = makeOutput(image), out4 = makeOutput(image);
 
 	cout << "Edge detection with filter size " << fSize << endl << endl;
 
 	// process image on CPU in parallel and produce out1
 	cout << "Start OpenMP" << endl;
 	sw.Start();
-	processParallel(image, out1, hFilter, vFilter, fSize);
+	filter.processParallel(image, out1, border);
 	sw.Stop();
 	parTime = sw.GetElapsedTimeMilliseconds();
 	cout << parTime << " ms" << endl << endl;
-	
-	// process image on GPU with OpenCL and produce out2
-	OCLData ocl = initOCL("..\\02_Exercise\\edges.cl", "edges");
-	cout << endl << "Start OpenCL on GPU" << endl;
+
+	// process image on CPU with separable filters and produce out3
+	cout << "Start separable OpenMP" << endl;
+	sw.Start();
+	if (processSeparable(image, out3, hFilter, vFilter, fSize, border)) {
+		sw.Stop();
+		cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << parTime/sw.GetElapsedTimeMilliseconds() << endl;
+		cout << boolalpha << "OpenMP and separable OpenMP produce the same results: " << equals(out1, out3) << endl << endl;
+	} else {
+		cout << "Filters are not separable" << endl << endl;
+	}
+
+	// process image on CPU with planar color channels and produce out4
+	cout << "Start planar OpenMP" << endl;
+	sw.Start();
+	if (processPlanar(image, out4, hFilter, vFilter, fSize, border)) {
+		sw.Stop();
+		cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << parTime/sw.GetElapsedTimeMilliseconds() << endl;
+		cout << boolalpha << "OpenMP and planar OpenMP produce the same results: " << equals(out1, out4) << endl << endl;
+	} else {
+		cout << "Filter responses exceed 16 bit" << endl << endl;
+	}
+
+	// process image on CPU with the kernel for arbitrary pixel formats and produce out4
+	cout << "Start typed OpenMP" << endl;
+	sw.Start();
+	processTyped(image, out4, fSize, border);
+	sw.Stop();
+	cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << parTime/sw.GetElapsedTimeMilliseconds() << endl;
+	cout << boolalpha << "OpenMP and typed OpenMP produce the same results: " << equals(out1, out4) << endl << endl;
+
+	// process image on CPU with running sums and produce out4
+	cout << "Start running-sum OpenMP" << endl;
+	sw.Start();
+	processRunningSum(image, out4, fSize, border);
+	sw.Stop();
+	cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << parTime/sw.GetElapsedTimeMilliseconds() << endl;
+	cout << boolalpha << "OpenMP and running-sum OpenMP produce the same results: " << equals(out1, out4) << endl << endl;
+
+	// process image on the first selected OpenCL device and produce out2
+	vector<OCLData> devices = initOCLDevices("..\\02_Exercise\\edges.cl", "edges", device);
+	OCLData ocl = devices.empty() ? OCLData() : devices.front();
+	cout << endl << "Start OpenCL on " << ocl.m_deviceName << endl;
 	sw.Start();
-	processOCL(ocl, image, out2, hFilter, vFilter, fSize);
+	processOCL(ocl, image, out2, hFilter, vFilter, fSize, border);
 	sw.Stop();
 	cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << parTime/sw.GetElapsedTimeMilliseconds() << endl;
+	printProfile(ocl);
 
 	// compare out1 with out2
-	cout << boolalpha << "OpenMP and OpenCL on GPU produce the same results: " << equals(out1, out2, fSize) << endl << endl;
+	cout << boolalpha << "OpenMP and OpenCL produce the same results: " << equals(out1, out2) << endl << endl;
+
+	// batch of copies of the image: one processOCL call per image against the streaming executor
+	{
+		const int nImages = 8;
+		vector<fipImage> outs(nImages, makeOutput(image));
+		vector<const fipImage*> inputs(nImages, &image);
+		vector<fipImage*> outputs;
+		for (fipImage& out: outs) outputs.push_back(&out);
+
+		cout << "Start OpenCL on a batch of " << nImages << " images" << endl;
+		sw.Start();
+		for (int i = 0; i < nImages; i++) processOCL(ocl, image, outs[i], hFilter, vFilter, fSize, border);
+		sw.Stop();
+		const double seqTime = sw.GetElapsedTimeMilliseconds();
+		cout << seqTime << " ms" << endl;
+
+		// the first call creates the queues and the persistent device objects
+		processOCLBatch(ocl, inputs, outputs, hFilter, vFilter, fSize, border);
+		for (fipImage& out: outs) memset(out.getScanLine(0), 0, out.getScanWidth()*out.getHeight());
+
+		cout << "Start streaming OpenCL on a batch of " << nImages << " images" << endl;
+		sw.Start();
+		processOCLBatch(ocl, inputs, outputs, hFilter, vFilter, fSize, border);
+		sw.Stop();
+		cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << seqTime/sw.GetElapsedTimeMilliseconds() << endl;
+		printProfile(ocl);
+
+		bool same = true;
+		for (const fipImage& out: outs) same = same && equals(out1, out);
+		cout << boolalpha << "OpenMP and streaming OpenCL produce the same results: " << same << endl << endl;
+	}
+
+	// split the rows among all selected devices and the OpenMP threads by measured throughput and produce out4
+	{
+		const RawFilter hostFilter = [&filter, border](const BYTE *input, BYTE *output, int w, int h, size_t stride) {
+			filter.processRaw(input, output, w, h, stride, border);
+		};
+		const vector<double> shares = calibrateSplit(devices, hostFilter, image, out4, hFilter, vFilter, fSize, border);
+
+		cout << "Start OpenCL on " << devices.size() << " device(s) and OpenMP" << endl;
+		for (size_t i = 0; i < devices.size(); i++) {
+			cout << devices[i].m_deviceName << ": " << 100*shares[i] << "% of the rows" << endl;
+		}
+		cout << "OpenMP: " << 100*shares.back() << "% of the rows" << endl;
+		sw.Start();
+		processSplit(devices, hostFilter, image, out4, hFilter, vFilter, fSize, border, shares);
+		sw.Stop();
+		cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << parTime/sw.GetElapsedTimeMilliseconds() << endl;
+		cout << boolalpha << "OpenMP and split OpenCL/OpenMP produce the same results: " << equals(out1, out4) << endl << endl;
+	}
 
 	// save output image
 	string outSuffix(argv[3]), outName;
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <cassert>
+#include <functional>
 #include "FreeImagePlus.h"
 #include "Stopwatch.h"
 
@@ -10,5 +11,21 @@ using namespace std;
 //#define FAST_MATH
 
 #ifndef WIN32
-typedef unsigned long COLORREF;
-#endif
\ No newline at end of file
+typedef unsigned int COLORREF;	// 32 bit as on Windows
+#endif
+
+// border handling of the edge filters (see border.cpp)
+enum class Border { Clamp, Mirror, Wrap, Zero };
+
+// edge filter with fixed filter size and border handling, used by the batch and streaming modes
+typedef function<void(const fipImage& input, fipImage& output)> ImageFilter;
+
+// edge filter on w x h BGRA images with scanlines of stride bytes, used by the multi-device split
+typedef function<void(const BYTE *input, BYTE *output, int w, int h, size_t stride)> RawFilter;
+
+// maps coordinate x to [0, n), returns -1 for pixels outside of the image in zero mode
+int remap(int x, int n, Border border);
+
+// computes the fSize/2 wide image frame, which the filters skip
+void processBorder(const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize, Border border);
+void processBorder(const BYTE *input, BYTE *output, int w, int h, size_t stride, const int *hFilter, const int *vFilter, int fSize, Border border);
\ No newline at end of file
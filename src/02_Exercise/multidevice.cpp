@@ -0,0 +1,128 @@
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "main.h"
+#include "ocl.h"
+
+////////////////////////////////////////////////////////////////////////
+// prototypes
+void processOCL(OCLData& ocl, const BYTE *input, BYTE *output, size_t w, size_t h, size_t stride, const int *hFilter, const int *vFilter, int fSize, Border border);
+
+////////////////////////////////////////////////////////////////////////
+// Filters rows [v0, v1) of the w x h image input into output. The band is filtered as an image on its own
+// with fSize/2 halo rows above and below, so the band borders of the filter only touch the discarded halo rows.
+// Halo rows outside of the image are gathered with the border handling of the whole image.
+static void processBand(const RawFilter& filter, const BYTE *input, BYTE *output, int w, int h, size_t stride, int fSize, Border border,
+	int v0, int v1, vector<BYTE>& in, vector<BYTE>& out)
+{
+	const int r = fSize/2;
+	const int bandH = v1 - v0 + 2*r;
+	const BYTE *bandIn;
+
+	if (v0 >= r && v1 + r <= h) {
+		bandIn = input + (v0 - r)*stride;
+	} else {
+		in.resize(bandH*stride);
+		for(int v = 0; v < bandH; v++) {
+			const int src = remap(v0 - r + v, h, border);
+
+			if (src < 0) memset(in.data() + v*stride, 0, stride);
+			else memcpy(in.data() + v*stride, input + src*stride, stride);
+		}
+		bandIn = in.data();
+	}
+	out.resize(bandH*stride);
+	filter(bandIn, out.data(), w, bandH, stride);
+	memcpy(output + v0*stride, out.data() + r*stride, (v1 - v0)*stride);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Splits the rows of input into consecutive bands: shares[i] is the fraction of rows of devices[i],
+// the last share belongs to hostFilter. The devices run in their own threads next to the OpenMP threads of the host.
+void processSplit(vector<OCLData>& devices, const RawFilter& hostFilter, const fipImage& input, fipImage& output,
+	const int *hFilter, const int *vFilter, int fSize, Border border, const vector<double>& shares)
+{
+	const int bypp = 4;
+	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
+	assert(input.getBitsPerPixel() == bypp*8);
+	assert(shares.size() == devices.size() + 1);
+
+	const int w = input.getWidth();
+	const int h = input.getHeight();
+	const size_t stride = input.getScanWidth();
+	const BYTE *in = input.getScanLine(0);
+	BYTE *out = output.getScanLine(0);
+
+	// band i consists of rows [rows[i], rows[i + 1])
+	const size_t n = shares.size();
+	double total = 0, sum = 0;
+	vector<int> rows(n + 1);
+
+	for(double s: shares) total += s;
+	for(size_t i = 0; i < n; i++) {
+		rows[i] = (total > 0) ? (int)(h*sum/total + 0.5) : 0;
+		sum += shares[i];
+	}
+	rows[n] = h;
+
+	vector<thread> threads;
+
+	for(size_t i = 0; i < devices.size(); i++) {
+		if (rows[i] < rows[i + 1]) {
+			threads.emplace_back([&, i] {
+				const RawFilter filter = [&](const BYTE *bandIn, BYTE *bandOut, int bw, int bh, size_t bs) {
+					processOCL(devices[i], bandIn, bandOut, bw, bh, bs, hFilter, vFilter, fSize, border);
+				};
+				vector<BYTE> bandIn, bandOut;
+				processBand(filter, in, out, w, h, stride, fSize, border, rows[i], rows[i + 1], bandIn, bandOut);
+			});
+		}
+	}
+	if (rows[n - 1] < rows[n]) {
+		vector<BYTE> bandIn, bandOut;
+		processBand(hostFilter, in, out, w, h, stride, fSize, border, rows[n - 1], rows[n], bandIn, bandOut);
+	}
+	for(thread& t: threads) t.join();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Measures the throughput of every device and of hostFilter (if any) on the whole image and returns
+// shares for processSplit proportional to it. The first run of a device contains one-time costs
+// of the driver, hence each participant filters the image twice and only the second run counts.
+vector<double> calibrateSplit(vector<OCLData>& devices, const RawFilter& hostFilter, const fipImage& input, fipImage& output,
+	const int *hFilter, const int *vFilter, int fSize, Border border)
+{
+	const int w = input.getWidth();
+	const int h = input.getHeight();
+	const size_t stride = input.getScanWidth();
+	const BYTE *in = input.getScanLine(0);
+	BYTE *out = output.getScanLine(0);
+
+	Stopwatch sw;
+	vector<double> shares(devices.size() + 1, 0.0);
+	double total = 0;
+
+	auto measure = [&](const RawFilter& filter) {
+		filter(in, out, w, h, stride);
+		sw.Start();
+		filter(in, out, w, h, stride);
+		sw.Stop();
+		return h/max(sw.GetElapsedTimeMilliseconds(), 1e-3);	// rows per ms
+	};
+
+	for(size_t i = 0; i < devices.size(); i++) {
+		shares[i] = measure([&](const BYTE *bandIn, BYTE *bandOut, int bw, int bh, size_t bs) {
+			processOCL(devices[i], bandIn, bandOut, bw, bh, bs, hFilter, vFilter, fSize, border);
+		});
+		total += shares[i];
+	}
+	if (hostFilter) {
+		shares.back() = measure(hostFilter);
+		total += shares.back();
+	}
+	if (total > 0) {
+		for(double& s: shares) s /= total;
+	}
+	return shares;
+}
@@ -2,104 +2,362 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <cstdlib>
+#include <cctype>
 #include "main.h"
 #include "ocl.h"
+#include "filters.h"
 
 ////////////////////////////////////////////////////////////////////////
-// TODO: adapt for choosing GPU or CPU
-OCLData initOCL(const char* kernelFileName, const char* kernelName) {
-	OCLData ocl;
-	vector<cl::Platform> platforms;
-	vector<cl::Device> devices;
+// 64 bit FNV-1a hash
+static unsigned long long fnv1a(const string& s) {
+	unsigned long long hash = 14695981039346656037ULL;
 
-	cout << "**************************************************************************" << endl;
+	for(unsigned char c: s) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Builds the program for the first of the given devices with a binary cache: the binary of a source build is stored
+// next to the kernel file under a hash of source, build options, device name and driver version,
+// later runs load it with clCreateProgramWithBinary. A missing or rejected binary falls back to the source build.
+static cl::Program buildProgram(const cl::Context& context, const vector<cl::Device>& devices, const string& source, const char* options, const char* kernelFileName, bool& cached) {
+	// the cache key describes exactly one device, so the program is built for this device only
+	const vector<cl::Device> device(1, devices[0]);
+	string deviceName, driverVersion;
+	device[0].getInfo(CL_DEVICE_NAME, &deviceName);
+	device[0].getInfo(CL_DRIVER_VERSION, &driverVersion);
+
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx", fnv1a(source + '\0' + options + '\0' + deviceName + '\0' + driverVersion));
+	const string cacheName = string(kernelFileName) + "." + hash + ".bin";
+
+	ifstream in(cacheName, ios::binary);
+	if (in.good()) {
+		const vector<char> binary((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+		try {
+			cl::Program::Binaries binaries(1, make_pair(binary.data(), binary.size()));
+			cl::Program program(context, device, binaries);
+			program.build(device, options);
+			cached = true;
+			return program;
+		} catch(cl::Error&) {
+			// the binary does not fit the device or driver
+		}
+	}
+
+	cl::Program::Sources progSource(1, make_pair(source.c_str(), source.length() + 1));	// create source code object
+	cl::Program program(context, progSource);												// create program object
+	program.build(device, options);															// build the program for the device
+	cached = false;
+
+	// store the binary of the device; the cache is optional, so errors are ignored
 	try {
-		// discover all available platforms
-		cl::Platform::get(&platforms);
-		if (platforms.empty()) {
-			cerr << "Error: no OpenCL platform available" << endl;
-			return ocl;
+		// the program has one binary per device of the context, only the built device has one with non-zero size
+		const vector<cl::Device> programDevices = program.getInfo<CL_PROGRAM_DEVICES>();
+		const vector<size_t> sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+		const size_t d = find_if(programDevices.begin(), programDevices.end(), [&](const cl::Device& dev) { return dev() == device[0](); }) - programDevices.begin();
+
+		if (d < sizes.size() && sizes[d] > 0) {
+			vector<char> binary(sizes[d]);
+			vector<char*> binaries(sizes.size(), nullptr);	// null entries are skipped
+
+			binaries[d] = binary.data();
+			program.getInfo(CL_PROGRAM_BINARIES, &binaries);
+			ofstream out(cacheName, ios::binary);
+			out.write(binary.data(), binary.size());
 		}
+	} catch(cl::Error&) {
+		// the program stays usable without cache entry
+	}
+	return program;
+}
+
+////////////////////////////////////////////////////////////////////////
+// selection is "gpu", "cpu", "accelerator", "all", a device index in the listed order or a part of the device name
+static bool isSelected(const cl::Device& dev, int index, const string& selection) {
+	cl_device_type type;	dev.getInfo(CL_DEVICE_TYPE, &type);
+	string name;			dev.getInfo(CL_DEVICE_NAME, &name);
 
-		string name, profile, version;
-		
-		for(cl::Platform& p: platforms) {
-			p.getInfo(CL_PLATFORM_NAME, &name);
-			p.getInfo(CL_PLATFORM_PROFILE, &profile);
-			p.getInfo(CL_PLATFORM_VERSION, &version);
+	if (selection == "all") return true;
+	if (selection == "gpu") return (type & CL_DEVICE_TYPE_GPU) != 0;
+	if (selection == "cpu") return (type & CL_DEVICE_TYPE_CPU) != 0;
+	if (selection == "accelerator") return (type & CL_DEVICE_TYPE_ACCELERATOR) != 0;
+	if (all_of(selection.begin(), selection.end(), [](char c) { return isdigit((unsigned char)c); })) return index == atoi(selection.c_str());
 
-			vector<cl::Device> devs;
+	auto lower = [](string s) { transform(s.begin(), s.end(), s.begin(), [](char c) { return (char)tolower((unsigned char)c); }); return s; };
+	return lower(name).find(lower(selection)) != string::npos;
+}
 
-			try {
-				// get GPUs of this platform
-				p.getDevices(CL_DEVICE_TYPE_GPU, &devs);
+////////////////////////////////////////////////////////////////////////
+// Shows all devices of all platforms and returns the selected ones. Without selection
+// the environment variable OCL_DEVICE is used and then the GPUs.
+static vector<cl::Device> findDevices(const char* device) {
+	vector<cl::Platform> platforms;
+	vector<cl::Device> selected;
+	const char* env = getenv("OCL_DEVICE");
+	const string selection = (device && *device) ? device : (env && *env) ? env : "gpu";
 
-			} catch(cl::Error&) {
-				// there is no GPU on this platform
-			}
+	// discover all available platforms
+	cl::Platform::get(&platforms);
+	if (platforms.empty()) {
+		cerr << "Error: no OpenCL platform available" << endl;
+		return selected;
+	}
+
+	string name, profile, version;
+	int index = 0;
+
+	for(cl::Platform& p: platforms) {
+		p.getInfo(CL_PLATFORM_NAME, &name);
+		p.getInfo(CL_PLATFORM_PROFILE, &profile);
+		p.getInfo(CL_PLATFORM_VERSION, &version);
+
+		vector<cl::Device> devs;
+
+		try {
+			p.getDevices(CL_DEVICE_TYPE_ALL, &devs);
 
-			if (!devs.empty()) {
-				// show platform
-				cout << "Platform " << name << " (" << version << ", " << profile << ")" << endl;
-
-				// discover all available GPUs on this platform
-				for(cl::Device& dev: devs) {
-					// get and show device information
-					dev.getInfo(CL_DEVICE_NAME, &name);
-					cl_uint maxComputeUnits;		dev.getInfo(CL_DEVICE_MAX_COMPUTE_UNITS, &maxComputeUnits);
-					cl_uint maxDims;				dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, &maxDims);
-					vector<size_t> workitemSize;	dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_SIZES, &workitemSize);
-					size_t workgroupSize;			dev.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &workgroupSize); // product of all dimensions
-					cl_ulong localMemSize;			dev.getInfo(CL_DEVICE_LOCAL_MEM_SIZE, &localMemSize);
-					cout << name << endl;
-					cout << "Max. Compute Units: " << maxComputeUnits << ", Max. Dimensions: " << maxDims << " [" << workitemSize[0] << "," << workitemSize[1] << "," << workitemSize[2] << "]" << endl;
-					cout << "Max. Work Group Size: " << workgroupSize << ", Max. Local Mem Size: " << localMemSize << endl << endl;
-				}
-
-				if (devices.empty()) {
-					// create s_context and command s_queue for the first GPU
-					cl::Device& dev = devs.front();
-					cl_context_properties cps[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)(p)(), 0 };
-
-					ocl.m_context = cl::Context(CL_DEVICE_TYPE_GPU, cps);
-					ocl.m_queue = cl::CommandQueue(ocl.m_context, dev);
-
-					// add first device
-					devices.push_back(dev);
-				}
+		} catch(cl::Error&) {
+			// there is no device on this platform
+		}
+
+		if (!devs.empty()) {
+			// show platform
+			cout << "Platform " << name << " (" << version << ", " << profile << ")" << endl;
+
+			// discover all available devices on this platform
+			for(cl::Device& dev: devs) {
+				// get and show device information
+				const bool chosen = isSelected(dev, index, selection);
+				dev.getInfo(CL_DEVICE_NAME, &name);
+				cl_uint maxComputeUnits;		dev.getInfo(CL_DEVICE_MAX_COMPUTE_UNITS, &maxComputeUnits);
+				cl_uint maxDims;				dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, &maxDims);
+				vector<size_t> workitemSize;	dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_SIZES, &workitemSize);
+				size_t workgroupSize;			dev.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &workgroupSize); // product of all dimensions
+				cl_ulong localMemSize;			dev.getInfo(CL_DEVICE_LOCAL_MEM_SIZE, &localMemSize);
+				cout << "[" << index << "] " << name << (chosen ? " (selected)" : "") << endl;
+				cout << "Max. Compute Units: " << maxComputeUnits << ", Max. Dimensions: " << maxDims << " [" << workitemSize[0] << "," << workitemSize[1] << "," << workitemSize[2] << "]" << endl;
+				cout << "Max. Work Group Size: " << workgroupSize << ", Max. Local Mem Size: " << localMemSize << endl << endl;
+
+				if (chosen) selected.push_back(dev);
+				index++;
 			}
 		}
+	}
+	if (selected.empty()) {
+		cerr << "Error: no OpenCL device matches " << selection << endl;
+	}
+	return selected;
+}
+
+////////////////////////////////////////////////////////////////////////
+// creates context, command queue and kernel for one device
+static OCLData createOCL(const cl::Device& dev, const string& prog, const char* kernelFileName, const char* kernelName) {
+	OCLData ocl;
+	const vector<cl::Device> devices(1, dev);
+
+	ocl.m_context = cl::Context(devices);
+	ocl.m_queue = cl::CommandQueue(ocl.m_context, dev, CL_QUEUE_PROFILING_ENABLE);
+	dev.getInfo(CL_DEVICE_NAME, &ocl.m_deviceName);
+
+	// compile and execute s_kernel code
+	Stopwatch sw;
+	bool cached;
+	sw.Start();
+	cl::Program program = buildProgram(ocl.m_context, devices, prog, "", kernelFileName, cached);
+	sw.Stop();
+	cout << "Program " << (cached ? "loaded from binary cache" : "built from source") << " for " << ocl.m_deviceName << " in " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
+	ocl.m_kernel = cl::Kernel(program, kernelName);										// create the s_kernel: must be the name of the s_kernel in the cl file
+
+	// specialized kernels for the filter sizes of the filter tables in main.cpp
+	double buildTime = 0;
+	int nCached = 0;
+
+	for(int size = 3; size <= 11; size += 2) {
+		OCLKernelVariant& variant = ocl.m_variants[size];
+		string hTaps, vTaps;
 
-		// read source file
-		ifstream file(kernelFileName);
-		if (!file.good()) {
-			perror("Error");
-			return ocl;
+		for(int j = 0; j < size; j++) {
+			for(int i = 0; i < size; i++) {
+				variant.m_hTaps.push_back(hTap(size, j, i));
+				variant.m_vTaps.push_back(vTap(size, j, i));
+				hTaps += (hTaps.empty() ? "" : ",") + to_string(variant.m_hTaps.back());
+				vTaps += (vTaps.empty() ? "" : ",") + to_string(variant.m_vTaps.back());
+			}
 		}
-		string prog(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));	// read in file and store it in string prog
-		file.close();
-		cl::Program::Sources progSource(1, make_pair(prog.c_str(), prog.length() + 1));	// create source code object
+		const string options = "-D FSIZE=" + to_string(size) + " -D H_TAPS=" + hTaps + " -D V_TAPS=" + vTaps;
+
+		sw.Start();
+		program = buildProgram(ocl.m_context, devices, prog, options.c_str(), kernelFileName, cached);
+		sw.Stop();
+		buildTime += sw.GetElapsedTimeMilliseconds();
+		if (cached) nCached++;
+		variant.m_kernel = cl::Kernel(program, kernelName);
+	}
+	cout << ocl.m_variants.size() << " specialized programs (" << nCached << " from binary cache) in " << buildTime << " ms" << endl;
+	return ocl;
+}
 
-		// compile and execute s_kernel code
-		cl::Program program(ocl.m_context, progSource);									// create program object
-		program.build(devices);															// build the program for given devices
-		ocl.m_kernel = cl::Kernel(program, kernelName);									// create the s_kernel: must be the name of the s_kernel in the cl file
+////////////////////////////////////////////////////////////////////////
+// one OpenCL context per selected device, at most maxDevices
+static vector<OCLData> initDevices(const char* kernelFileName, const char* kernelName, const char* device, size_t maxDevices) {
+	vector<OCLData> ocls;
+
+	cout << "**************************************************************************" << endl;
+	try {
+		vector<cl::Device> devices = findDevices(device);
+		if (devices.size() > maxDevices) devices.resize(maxDevices);
+
+		if (!devices.empty()) {
+			// read source file
+			ifstream file(kernelFileName);
+			if (!file.good()) {
+				perror("Error");
+				return ocls;
+			}
+			string prog(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));	// read in file and store it in string prog
+			file.close();
+
+			for(const cl::Device& dev: devices) {
+				ocls.push_back(createOCL(dev, prog, kernelFileName, kernelName));
+			}
+		}
 
 	} catch(cl::Error& err) {
 		cerr << "OpenCL error: " << err.what() << "(" << err.err() << ")" << endl;
 	}
 	cout << "**************************************************************************" << endl;
-	return ocl;
+	return ocls;
 }
 
 ////////////////////////////////////////////////////////////////////////
-void processOCL(OCLData& ocl, const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize) {
-	const int bypp = 4;
-	const size_t w = input.getWidth();
-	const size_t h = input.getHeight();
-	assert(w == output.getWidth() && h == output.getHeight() && input.getImageSize() == output.getImageSize());
-	assert(input.getBitsPerPixel() == bypp*8);
-	const size_t stride = input.getScanWidth();
+// first selected device, see findDevices
+OCLData initOCL(const char* kernelFileName, const char* kernelName, const char* device) {
+	vector<OCLData> ocls = initDevices(kernelFileName, kernelName, device, 1);
+
+	return ocls.empty() ? OCLData() : ocls.front();
+}
+
+////////////////////////////////////////////////////////////////////////
+// all selected devices, see findDevices
+vector<OCLData> initOCLDevices(const char* kernelFileName, const char* kernelName, const char* device) {
+	return initDevices(kernelFileName, kernelName, device, SIZE_MAX);
+}
+
+////////////////////////////////////////////////////////////////////////
+// work-group size of the tiled kernel: as large as device and kernel allow (at most 32 x 32),
+// such that the tile with a halo of fSize/2 pixels on each side fits into local memory
+static void getWorkGroupSize(const OCLData& ocl, const cl::Kernel& kernel, int fSize, size_t bypp, size_t& lw, size_t& lh) {
+	const cl::Device dev = ocl.m_queue.getInfo<CL_QUEUE_DEVICE>();
+	size_t maxSize;					dev.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &maxSize);
+	vector<size_t> maxItems;		dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_SIZES, &maxItems);
+	cl_ulong localMemSize;			dev.getInfo(CL_DEVICE_LOCAL_MEM_SIZE, &localMemSize);
+	const size_t halo = 2*(fSize/2);
+
+	maxSize = min(maxSize, kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev));
+	lw = lh = 32;
+
+	// halve the height first: wide tiles read longer rows of the image
+	while (lw*lh > 1 && (lw*lh > maxSize || lw > maxItems[0] || lh > maxItems[1] || (lw + halo)*(lh + halo)*bypp > localMemSize)) {
+		if (lh >= lw) lh /= 2;
+		else lw /= 2;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// specialized kernel of filter size fSize if its taps are the given filters, otherwise the runtime kernel
+static cl::Kernel& getKernel(OCLData& ocl, const int *hFilter, const int *vFilter, int fSize) {
+	auto it = ocl.m_variants.find(fSize);
+
+	if (it != ocl.m_variants.end() && equal(it->second.m_hTaps.begin(), it->second.m_hTaps.end(), hFilter)
+		&& equal(it->second.m_vTaps.begin(), it->second.m_vTaps.end(), vFilter)) {
+		return it->second.m_kernel;
+	}
+	return ocl.m_kernel;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Devices sharing memory with the host (CPU devices, integrated GPUs) can use host memory in place (CL_MEM_USE_HOST_PTR).
+// Drivers avoid the copy only for page aligned memory whose size is a multiple of cache lines.
+static bool isZeroCopy(const cl::Device& dev, const void *p, size_t size) {
+	const size_t pageSize = 4096, cacheLineSize = 64;
+	cl_bool unified;				dev.getInfo(CL_DEVICE_HOST_UNIFIED_MEMORY, &unified);
+	cl_uint baseAddrAlign;			dev.getInfo(CL_DEVICE_MEM_BASE_ADDR_ALIGN, &baseAddrAlign); // in bits
+	const size_t alignment = max(pageSize, (size_t)baseAddrAlign/8);
+
+	return unified && reinterpret_cast<uintptr_t>(p)%alignment == 0 && size%cacheLineSize == 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// records the event of the next enqueued command, bytes is the size of a transfer or 0
+static cl::Event* addPhase(OCLData& ocl, const char* name, size_t bytes) {
+	ocl.m_phases.push_back(OCLPhase{ name, cl::Event(), bytes });
+	return &ocl.m_phases.back().m_event;
+}
+
+////////////////////////////////////////////////////////////////////////
+// repeat modes require normalized coordinates, CL_ADDRESS_CLAMP returns a zero border color
+static cl_addressing_mode getAddressing(Border border) {
+	switch(border) {
+	case Border::Mirror:	return CL_ADDRESS_MIRRORED_REPEAT;
+	case Border::Wrap:		return CL_ADDRESS_REPEAT;
+	case Border::Zero:		return CL_ADDRESS_CLAMP;
+	default:				return CL_ADDRESS_CLAMP_TO_EDGE;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// Prints the event profile of the commands of the last call: queued, submit, start and end times
+// relative to the first queued command and the effective bandwidth of each transfer.
+void printProfile(const OCLData& ocl) {
+	if (ocl.m_phases.empty()) return;
+
+	try {
+		const double ms = 1e-6;		// profiling times are in ns
+		const cl_ulong t0 = ocl.m_phases.front().m_event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+		cl_ulong tEnd = t0, transferTime = 0, commandTime = 0;
+		size_t transferBytes = 0;
+
+		cout << "OpenCL profile of " << ocl.m_deviceName << " (ms since the first command was queued)" << endl;
+		for(const OCLPhase& phase: ocl.m_phases) {
+			const cl_ulong queued = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+			const cl_ulong submit = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+			const cl_ulong start = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+			const cl_ulong end = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+			const cl_ulong duration = max(end - start, (cl_ulong)1);
+
+			cout << phase.m_name << ": queued " << (queued - t0)*ms << ", submit " << (submit - t0)*ms << ", start " << (start - t0)*ms
+				<< ", end " << (end - t0)*ms << ", duration " << duration*ms << " ms";
+			if (phase.m_bytes) {
+				cout << ", " << (double)phase.m_bytes/duration << " GB/s";	// bytes per ns
+				transferTime += duration;
+				transferBytes += phase.m_bytes;
+			} else {
+				commandTime += duration;
+			}
+			cout << endl;
+			tEnd = max(tEnd, end);
+		}
+		cout << "transfers " << transferTime*ms << " ms";
+		if (transferBytes) cout << " (" << (double)transferBytes/max(transferTime, (cl_ulong)1) << " GB/s)";
+		cout << ", other commands " << commandTime*ms << " ms, first queued to last end " << (tEnd - t0)*ms << " ms" << endl;
+
+	} catch(cl::Error& err) {
+		cerr << "OpenCL error: " << err.what() << "(" << err.err() << ")" << endl;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// input and output are w x h BGRA images with scanlines of stride bytes, e.g. memory mapped raw images
+void processOCL(OCLData& ocl, const BYTE *input, BYTE *output, size_t w, size_t h, size_t stride, const int *hFilter, const int *vFilter, int fSize, Border border) {
 	const int fSize2 = fSize*fSize;
 	
 	cl::size_t<3> origin;
@@ -107,6 +365,7 @@ void processOCL(OCLData& ocl, const fipImage& input, fipImage& output, const int
 	region[0] = w; 
 	region[1] = h; 
 	region[2] = 1;
+	ocl.m_phases.clear();
 
 	try {
 		// the image format describes the properties of each pixel
@@ -115,34 +374,189 @@ void processOCL(OCLData& ocl, const fipImage& input, fipImage& output, const int
 		format.image_channel_data_type = CL_UNSIGNED_INT8;
 
 		// create sampler object
-		cl::Sampler sampler(ocl.m_context, CL_FALSE, CL_ADDRESS_CLAMP_TO_EDGE, CL_FILTER_NEAREST); // on CPU must be not CL_ADDRESS_NONE
+		cl::Sampler sampler(ocl.m_context, CL_TRUE, getAddressing(border), CL_FILTER_NEAREST); // on CPU must be not CL_ADDRESS_NONE
 
-		// create space for the images
-		cl::Image2D source(ocl.m_context, CL_MEM_READ_ONLY, format, region[0], region[1], 0);
-		cl::Image2D dest (ocl.m_context, CL_MEM_WRITE_ONLY, format, region[0], region[1], 0);
+		// wrap the scanlines if the device can use them in place, otherwise create space for the images
+		const cl::Device dev = ocl.m_queue.getInfo<CL_QUEUE_DEVICE>();
+		const bool zeroCopy = isZeroCopy(dev, input, stride*h) && isZeroCopy(dev, output, stride*h);
+		cl::Image2D source, dest;
+
+		if (zeroCopy) {
+			source = cl::Image2D(ocl.m_context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, format, region[0], region[1], stride, const_cast<BYTE*>(input));
+			dest = cl::Image2D(ocl.m_context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, format, region[0], region[1], stride, output);
+		} else {
+			source = cl::Image2D(ocl.m_context, CL_MEM_READ_ONLY, format, region[0], region[1], 0);
+			dest = cl::Image2D(ocl.m_context, CL_MEM_WRITE_ONLY, format, region[0], region[1], 0);
+			ocl.m_queue.enqueueWriteImage(source, CL_TRUE, origin, region, stride, 0, const_cast<BYTE*>(input), nullptr, addPhase(ocl, "upload image", w*h*4));
+		}
 
 		// create space for the filters
 		cl::Buffer hor(ocl.m_context, CL_MEM_READ_ONLY, fSize2*sizeof(int));
 		cl::Buffer ver(ocl.m_context, CL_MEM_READ_ONLY, fSize2*sizeof(int));
 
 		// write buffers to device
-		ocl.m_queue.enqueueWriteImage(source, CL_TRUE, origin, region, stride, 0, input.getScanLine(0));
-		ocl.m_queue.enqueueWriteBuffer(hor, CL_TRUE, 0, fSize2*sizeof(int), hFilter);
-		ocl.m_queue.enqueueWriteBuffer(ver, CL_TRUE, 0, fSize2*sizeof(int), vFilter);
-
-		// set the kernel arguments
-		ocl.m_kernel.setArg(0, source);
-		ocl.m_kernel.setArg(1, dest);
-		ocl.m_kernel.setArg(2, hor);
-		ocl.m_kernel.setArg(3, ver);
-		ocl.m_kernel.setArg(4, fSize);
-		ocl.m_kernel.setArg(5, sampler);
-
-		// run the kernels
-		ocl.m_queue.enqueueNDRangeKernel(ocl.m_kernel, cl::NullRange, cl::NDRange(region[0], region[1]), cl::NullRange);
-
-		// read the output buffer back to the host
-		ocl.m_queue.enqueueReadImage(dest, CL_TRUE, origin, region, stride, 0, output.getScanLine(0));
+		ocl.m_queue.enqueueWriteBuffer(hor, CL_TRUE, 0, fSize2*sizeof(int), hFilter, nullptr, addPhase(ocl, "upload h filter", fSize2*sizeof(int)));
+		ocl.m_queue.enqueueWriteBuffer(ver, CL_TRUE, 0, fSize2*sizeof(int), vFilter, nullptr, addPhase(ocl, "upload v filter", fSize2*sizeof(int)));
+
+		// set the kernel arguments: specialized kernels ignore the filter arguments
+		cl::Kernel& kernel = getKernel(ocl, hFilter, vFilter, fSize);
+		kernel.setArg(0, source);
+		kernel.setArg(1, dest);
+		kernel.setArg(2, hor);
+		kernel.setArg(3, ver);
+		kernel.setArg(4, fSize);
+		kernel.setArg(5, sampler);
+		kernel.setArg(6, (int)w);
+		kernel.setArg(7, (int)h);
+
+		// local memory tile of each work-group: work-group size plus halo
+		const size_t bypp = 4;
+		size_t lw, lh;
+		getWorkGroupSize(ocl, kernel, fSize, bypp, lw, lh);
+		kernel.setArg(8, (lw + 2*(fSize/2))*(lh + 2*(fSize/2))*bypp, nullptr);
+
+		// run the kernels: the global size is a multiple of the work-group size
+		ocl.m_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange((w + lw - 1)/lw*lw, (h + lh - 1)/lh*lh), cl::NDRange(lw, lh), nullptr, addPhase(ocl, "kernel", 0));
+
+		if (zeroCopy) {
+			// mapping makes the kernel results visible in the host memory
+			size_t rowPitch;
+			void *mapped = ocl.m_queue.enqueueMapImage(dest, CL_TRUE, CL_MAP_READ, origin, region, &rowPitch, nullptr, nullptr, addPhase(ocl, "map image", 0));
+			ocl.m_queue.enqueueUnmapMemObject(dest, mapped, nullptr, addPhase(ocl, "unmap image", 0));
+			ocl.m_queue.finish();
+		} else {
+			// read the output buffer back to the host
+			ocl.m_queue.enqueueReadImage(dest, CL_TRUE, origin, region, stride, 0, output, nullptr, addPhase(ocl, "download image", w*h*4));
+		}
+
+	} catch(cl::Error& err) {
+		cerr << "OpenCL error: " << err.what() << "(" << err.err() << ")" << endl;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+void processOCL(OCLData& ocl, const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize, Border border) {
+	const int bypp = 4;
+	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
+	assert(input.getBitsPerPixel() == bypp*8);
+
+	processOCL(ocl, input.getScanLine(0), output.getScanLine(0), input.getWidth(), input.getHeight(), input.getScanWidth(), hFilter, vFilter, fSize, border);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Streaming executor for batches of BGRA images: uploads, kernels and downloads run on three command queues,
+// so the upload of image i+1 and the download of image i-1 overlap with the kernel on image i. Each of the three
+// slots holds the device images of one image in flight; events order the reuse of a slot after its previous
+// kernel and download. Device images, sampler and filter buffers persist in ocl.m_batch between calls,
+// only images of a new size allocate device memory. The commands are recorded for printProfile.
+void processOCLBatch(OCLData& ocl, const vector<const fipImage*>& inputs, const vector<fipImage*>& outputs, const int *hFilter, const int *vFilter, int fSize, Border border) {
+	const int bypp = 4;
+	const size_t fSize2 = fSize*fSize;
+	const size_t nSlots = 3;
+	assert(inputs.size() == outputs.size());
+
+	cl::size_t<3> origin;
+	cl::size_t<3> region;
+	region[2] = 1;
+	ocl.m_phases.clear();
+
+	try {
+		OCLBatch& batch = ocl.m_batch;
+		const cl::Device dev = ocl.m_queue.getInfo<CL_QUEUE_DEVICE>();
+
+		// the image format describes the properties of each pixel
+		cl::ImageFormat format;
+		format.image_channel_order = CL_BGRA;
+		format.image_channel_data_type = CL_UNSIGNED_INT8;
+
+		if (batch.m_slots.empty()) {
+			batch.m_upload = cl::CommandQueue(ocl.m_context, dev, CL_QUEUE_PROFILING_ENABLE);
+			batch.m_download = cl::CommandQueue(ocl.m_context, dev, CL_QUEUE_PROFILING_ENABLE);
+			batch.m_slots.resize(nSlots);
+		}
+		if (!batch.m_sampler() || batch.m_addressing != getAddressing(border)) {
+			batch.m_addressing = getAddressing(border);
+			batch.m_sampler = cl::Sampler(ocl.m_context, CL_TRUE, batch.m_addressing, CL_FILTER_NEAREST);
+		}
+		if (batch.m_hTaps.size() != fSize2 || !equal(batch.m_hTaps.begin(), batch.m_hTaps.end(), hFilter) || !equal(batch.m_vTaps.begin(), batch.m_vTaps.end(), vFilter)) {
+			// the kernel queue is in order: kernels of earlier calls have read the old taps
+			batch.m_hTaps.assign(hFilter, hFilter + fSize2);
+			batch.m_vTaps.assign(vFilter, vFilter + fSize2);
+			batch.m_hFilter = cl::Buffer(ocl.m_context, CL_MEM_READ_ONLY, fSize2*sizeof(int));
+			batch.m_vFilter = cl::Buffer(ocl.m_context, CL_MEM_READ_ONLY, fSize2*sizeof(int));
+			ocl.m_queue.enqueueWriteBuffer(batch.m_hFilter, CL_TRUE, 0, fSize2*sizeof(int), hFilter);
+			ocl.m_queue.enqueueWriteBuffer(batch.m_vFilter, CL_TRUE, 0, fSize2*sizeof(int), vFilter);
+		}
+
+		// specialized kernels ignore the filter arguments
+		cl::Kernel& kernel = getKernel(ocl, hFilter, vFilter, fSize);
+
+		// local memory tile of each work-group: work-group size plus halo
+		size_t lw, lh;
+		getWorkGroupSize(ocl, kernel, fSize, bypp, lw, lh);
+		const size_t tileBytes = (lw + 2*(fSize/2))*(lh + 2*(fSize/2))*bypp;
+
+		for(size_t i = 0; i < inputs.size(); i++) {
+			const fipImage& input = *inputs[i];
+			fipImage& output = *outputs[i];
+			const size_t w = input.getWidth();
+			const size_t h = input.getHeight();
+			const size_t stride = input.getScanWidth();
+			assert(w == output.getWidth() && h == output.getHeight() && input.getImageSize() == output.getImageSize());
+			assert(input.getBitsPerPixel() == bypp*8);
+
+			OCLBatchSlot& slot = batch.m_slots[i%nSlots];
+			vector<cl::Event> sourceFree, destFree;
+			region[0] = w;
+			region[1] = h;
+
+			if (slot.m_w != w || slot.m_h != h) {
+				// released images live until their pending commands have completed
+				slot.m_source = cl::Image2D(ocl.m_context, CL_MEM_READ_ONLY, format, w, h, 0);
+				slot.m_dest = cl::Image2D(ocl.m_context, CL_MEM_WRITE_ONLY, format, w, h, 0);
+				slot.m_w = w;
+				slot.m_h = h;
+			} else {
+				// the previous kernel of the slot reads the source image, the previous download reads the destination image
+				if (slot.m_filtered()) sourceFree.push_back(slot.m_filtered);
+				if (slot.m_downloaded()) destFree.push_back(slot.m_downloaded);
+			}
+
+			// upload image i while the kernel queue still works on image i-1
+			cl::Event uploaded;
+			batch.m_upload.enqueueWriteImage(slot.m_source, CL_FALSE, origin, region, stride, 0, input.getScanLine(0), sourceFree.empty() ? nullptr : &sourceFree, &uploaded);
+
+			// kernel arguments are captured when the kernel is enqueued
+			kernel.setArg(0, slot.m_source);
+			kernel.setArg(1, slot.m_dest);
+			kernel.setArg(2, batch.m_hFilter);
+			kernel.setArg(3, batch.m_vFilter);
+			kernel.setArg(4, fSize);
+			kernel.setArg(5, batch.m_sampler);
+			kernel.setArg(6, (int)w);
+			kernel.setArg(7, (int)h);
+			kernel.setArg(8, tileBytes, nullptr);
+
+			vector<cl::Event> ready(1, uploaded);
+			ready.insert(ready.end(), destFree.begin(), destFree.end());
+			ocl.m_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange((w + lw - 1)/lw*lw, (h + lh - 1)/lh*lh), cl::NDRange(lw, lh), &ready, &slot.m_filtered);
+
+			// download image i while the kernel queue continues with image i+1
+			const vector<cl::Event> filtered(1, slot.m_filtered);
+			batch.m_download.enqueueReadImage(slot.m_dest, CL_FALSE, origin, region, stride, 0, output.getScanLine(0), &filtered, &slot.m_downloaded);
+
+			// submit the commands now instead of at the end of the batch
+			batch.m_upload.flush();
+			ocl.m_queue.flush();
+			batch.m_download.flush();
+
+			ocl.m_phases.push_back(OCLPhase{ "upload image", uploaded, w*h*bypp });
+			ocl.m_phases.push_back(OCLPhase{ "kernel", slot.m_filtered, 0 });
+			ocl.m_phases.push_back(OCLPhase{ "download image", slot.m_downloaded, w*h*bypp });
+		}
+
+		// the downloads complete in order
+		batch.m_download.finish();
 
 	} catch(cl::Error& err) {
 		cerr << "OpenCL error: " << err.what() << "(" << err.err() << ")" << endl;
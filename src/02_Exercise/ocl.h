@@ -3,6 +3,7 @@
 #define CL_USE_DEPRECATED_OPENCL_2_0_APIS
 #define __CL_ENABLE_EXCEPTIONS
 #include "cl.hpp"
+#include <map>
 
 // http://www.khronos.org/registry/cl/specs/opencl-cplusplus-1.2.pdf	// C++ manual
 // http://www.khronos.org/registry/cl/specs/opencl-1.2.pdf				// C manual
@@ -10,8 +11,42 @@
 // error numbers are defined in cl.h 
 //#include <CL/cl.h>
 
+// event of an enqueued command with the number of transferred bytes (0 for kernels and mappings), see printProfile
+struct OCLPhase {
+	const char* m_name;
+	cl::Event m_event;
+	size_t m_bytes;
+};
+
+// device images of one image in flight of the batch executor, see processOCLBatch
+struct OCLBatchSlot {
+	cl::Image2D m_source, m_dest;
+	size_t m_w = 0, m_h = 0;
+	cl::Event m_filtered, m_downloaded;	// last kernel and download using the images
+};
+
+// objects of the batch executor kept between calls: kernels run on OCLData::m_queue, transfers on their own queues
+struct OCLBatch {
+	cl::CommandQueue m_upload, m_download;
+	cl::Sampler m_sampler;
+	cl_addressing_mode m_addressing = 0;
+	cl::Buffer m_hFilter, m_vFilter;
+	std::vector<int> m_hTaps, m_vTaps;	// contents of the filter buffers
+	std::vector<OCLBatchSlot> m_slots;
+};
+
+// kernel built with -D FSIZE=k: filter size and taps are compile-time constants of the kernel
+struct OCLKernelVariant {
+	cl::Kernel m_kernel;
+	std::vector<int> m_hTaps, m_vTaps;
+};
+
 struct OCLData {
 	cl::Context m_context;
 	cl::CommandQueue m_queue;
-	cl::Kernel m_kernel;
+	cl::Kernel m_kernel;						// reads filter size and taps at runtime
+	std::map<int, OCLKernelVariant> m_variants;	// specialized kernels by filter size
+	std::string m_deviceName;
+	std::vector<OCLPhase> m_phases;		// commands of the last processOCL or processOCLBatch call
+	OCLBatch m_batch;
 };
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <climits>
+#include "main.h"
+#include "magnitude.h"
+
+////////////////////////////////////////////////////////////////////////
+// Planar (structure of arrays) edge detection: the interleaved BGRA input is deinterleaved into
+// one byte plane per color channel, each non-zero filter tap is then applied to a whole row
+// of a plane with 16 bit accumulators, i.e. 8 pixels per SSE2 register instead of 3 channels,
+// and the magnitudes of the three channels are reinterleaved into BGRA.
+
+// non-zero filter tap: offsets relative to the center and weights of both filters
+struct PlanarTap {
+	int m_dx, m_dy;
+	short m_h, m_v;
+};
+
+////////////////////////////////////////////////////////////////////////
+// splits n BGRA pixels into the blue, green and red planes
+static void deinterleave(const BYTE *iPos, BYTE *b, BYTE *g, BYTE *r, int n) {
+	int u = 0;
+#ifdef USE_SSE2
+	// 16 pixels per iteration: the channel bytes are masked out of the 32 bit pixels and packed together
+	const __m128i mask = _mm_set1_epi32(0xFF);
+
+	for (; u + 16 <= n; u += 16) {
+		const __m128i *p = reinterpret_cast<const __m128i*>(iPos + 4*u);
+		const __m128i p0 = _mm_loadu_si128(p), p1 = _mm_loadu_si128(p + 1), p2 = _mm_loadu_si128(p + 2), p3 = _mm_loadu_si128(p + 3);
+		const __m128i b01 = _mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+		const __m128i b23 = _mm_packs_epi32(_mm_and_si128(p2, mask), _mm_and_si128(p3, mask));
+		const __m128i g01 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask), _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+		const __m128i g23 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 8), mask), _mm_and_si128(_mm_srli_epi32(p3, 8), mask));
+		const __m128i r01 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask), _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+		const __m128i r23 = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p2, 16), mask), _mm_and_si128(_mm_srli_epi32(p3, 16), mask));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(b + u), _mm_packus_epi16(b01, b23));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(g + u), _mm_packus_epi16(g01, g23));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(r + u), _mm_packus_epi16(r01, r23));
+	}
+#endif
+	const RGBQUAD *iC = reinterpret_cast<const RGBQUAD*>(iPos);
+	for (; u < n; u++) {
+		b[u] = iC[u].rgbBlue;
+		g[u] = iC[u].rgbGreen;
+		r[u] = iC[u].rgbRed;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// acc[i] += weight*src[i] for i in [0, n)
+static void accumulate(const BYTE *src, short weight, short *acc, int n) {
+	int i = 0;
+#ifdef USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i wv = _mm_set1_epi16(weight);
+
+	for (; i + 16 <= n; i += 16) {
+		const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i *a = reinterpret_cast<__m128i*>(acc + i);
+		_mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), wv)));
+		_mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1), _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), wv)));
+	}
+#endif
+	for (; i < n; i++) acc[i] += weight*src[i];
+}
+
+#ifdef USE_SSE2
+////////////////////////////////////////////////////////////////////////
+// magnitudes of 8 pixels of one channel in the low 8 bytes, bit-identical to storeMagnitude
+static __m128i magnitude8(const short *hAcc, const short *vAcc) {
+	const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hAcc));
+	const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(vAcc));
+	const __m128i lo = _mm_unpacklo_epi16(h, v), hi = _mm_unpackhi_epi16(h, v);
+	const __m128 limit = _mm_set1_ps((float)MagnitudeLimit);
+	const __m128i dLo = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_min_ps(_mm_cvtepi32_ps(_mm_madd_epi16(lo, lo)), limit)));
+	const __m128i dHi = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_min_ps(_mm_cvtepi32_ps(_mm_madd_epi16(hi, hi)), limit)));
+	const __m128i d = _mm_packs_epi32(dLo, dHi);
+	return _mm_packus_epi16(d, d);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// writes n BGRA pixels with the magnitudes of the three channels and alpha = 255
+static void reinterleave(short *const hAcc[3], short *const vAcc[3], RGBQUAD *oC, int n) {
+	int u = 0;
+#ifdef USE_SSE2
+	const __m128i alpha = _mm_set1_epi8((char)0xFF);
+
+	for (; u + 8 <= n; u += 8) {
+		const __m128i bg = _mm_unpacklo_epi8(magnitude8(hAcc[0] + u, vAcc[0] + u), magnitude8(hAcc[1] + u, vAcc[1] + u));
+		const __m128i ra = _mm_unpacklo_epi8(magnitude8(hAcc[2] + u, vAcc[2] + u), alpha);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(oC + u), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(oC + u + 4), _mm_unpackhi_epi16(bg, ra));
+	}
+#endif
+	for (; u < n; u++) {
+		oC[u].rgbBlue = magnitude(hAcc[0][u], vAcc[0][u]);
+		oC[u].rgbGreen = magnitude(hAcc[1][u], vAcc[1][u]);
+		oC[u].rgbRed = magnitude(hAcc[2][u], vAcc[2][u]);
+		oC[u].rgbReserved = 255;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// Returns false (and leaves output unchanged) if the filter responses could overflow 16 bit
+bool processPlanar(const BYTE *input, BYTE *output, int w, int h, size_t stride, const int *hFilter, const int *vFilter, int fSize, Border border) {
+	const int fSizeD2 = fSize/2;
+	vector<PlanarTap> taps;
+	int hSum = 0, vSum = 0;
+
+	for (int j = 0; j < fSize; j++) {
+		for (int i = 0; i < fSize; i++) {
+			const int hf = hFilter[j*fSize + i], vf = vFilter[j*fSize + i];
+			if (hf != 0 || vf != 0) taps.push_back({ i - fSizeD2, j - fSizeD2, (short)hf, (short)vf });
+			hSum += abs(hf);
+			vSum += abs(vf);
+		}
+	}
+	if (255*max(hSum, vSum) > SHRT_MAX) return false;
+
+	processBorder(input, output, w, h, stride, hFilter, vFilter, fSize, border);
+	const int n = w - 2*fSizeD2;
+	if (n <= 0 || h < fSize) return true;
+
+	// blue, green and red planes with w bytes per row
+	vector<BYTE> planes(3*(size_t)w*h);
+	BYTE *plane[3] = { planes.data(), planes.data() + (size_t)w*h, planes.data() + 2*(size_t)w*h };
+
+	#pragma omp parallel
+	{
+		// per thread accumulators of one output row
+		vector<short> acc(6*(size_t)n);
+		short *const hAcc[3] = { acc.data(), acc.data() + n, acc.data() + 2*n };
+		short *const vAcc[3] = { acc.data() + 3*n, acc.data() + 4*n, acc.data() + 5*n };
+
+		#pragma omp for
+		for (int v = 0; v < h; v++) {
+			const size_t offset = (size_t)v*w;
+			deinterleave(input + v*stride, plane[0] + offset, plane[1] + offset, plane[2] + offset, w);
+		}
+
+		#pragma omp for
+		for (int v = fSizeD2; v < h - fSizeD2; v++) {
+			fill(acc.begin(), acc.end(), (short)0);
+			for (int c = 0; c < 3; c++) {
+				for (const PlanarTap& t: taps) {
+					const BYTE *src = plane[c] + (size_t)(v + t.m_dy)*w + fSizeD2 + t.m_dx;
+					if (t.m_h) accumulate(src, t.m_h, hAcc[c], n);
+					if (t.m_v) accumulate(src, t.m_v, vAcc[c], n);
+				}
+			}
+			reinterleave(hAcc, vAcc, reinterpret_cast<RGBQUAD*>(output + v*stride) + fSizeD2, n);
+		}
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+bool processPlanar(const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize, Border border) {
+	const int bypp = 4;
+	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
+	assert(input.getBitsPerPixel() == bypp*8);
+
+	return processPlanar(input.getScanLine(0), output.getScanLine(0), input.getWidth(), input.getHeight(), input.getScanWidth(), hFilter, vFilter, fSize, border);
+}
@@ -0,0 +1,146 @@
+#include <cstring>
+#include <algorithm>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "rawimage.h"
+
+////////////////////////////////////////////////////////////////////////
+static const char RawMagic[4] = { 'B', 'G', 'R', 'A' };
+static const uint32_t RawVersion = 1;
+static const size_t RawAlignment = 64;
+
+////////////////////////////////////////////////////////////////////////
+RawImage::RawImage() : m_base(nullptr), m_size(0)
+#ifdef WIN32
+	, m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr)
+#else
+	, m_file(-1)
+#endif
+{}
+
+////////////////////////////////////////////////////////////////////////
+RawImage::~RawImage() {
+	close();
+}
+
+////////////////////////////////////////////////////////////////////////
+// maps size bytes of the file; size 0 maps the whole existing file
+bool RawImage::map(const char* fileName, size_t size, bool writable, bool create) {
+	close();
+#ifdef WIN32
+	m_file = CreateFileA(fileName, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) return false;
+
+	if (size == 0) {
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(m_file, &fileSize)) { close(); return false; }
+		size = (size_t)fileSize.QuadPart;
+	}
+	if (size < sizeof(RawImageHeader)) { close(); return false; }
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+	if (!m_mapping) { close(); return false; }
+	m_base = static_cast<BYTE*>(MapViewOfFile(m_mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size));
+	if (!m_base) { close(); return false; }
+#else
+	m_file = ::open(fileName, writable ? (create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR) : O_RDONLY, 0644);
+	if (m_file < 0) return false;
+
+	if (size == 0) {
+		struct stat st;
+		if (fstat(m_file, &st) != 0) { close(); return false; }
+		size = (size_t)st.st_size;
+	} else if (ftruncate(m_file, (off_t)size) != 0) {
+		close();
+		return false;
+	}
+	if (size < sizeof(RawImageHeader)) { close(); return false; }
+
+	void *p = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_file, 0);
+	if (p == MAP_FAILED) { close(); return false; }
+	m_base = static_cast<BYTE*>(p);
+#endif
+	m_size = size;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+bool RawImage::open(const char* fileName, bool writable) {
+	if (!map(fileName, 0, writable, false)) return false;
+
+	const RawImageHeader& h = header();
+	if (memcmp(h.m_magic, RawMagic, sizeof(RawMagic)) != 0 || h.m_version != RawVersion || h.m_stride < (uint64_t)4*h.m_width || h.m_stride%RawAlignment != 0
+		|| sizeof(RawImageHeader) + h.m_stride*h.m_height > m_size) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+bool RawImage::create(const char* fileName, int width, int height) {
+	const size_t stride = (4*(size_t)width + RawAlignment - 1)/RawAlignment*RawAlignment;
+	if (width <= 0 || height <= 0 || !map(fileName, sizeof(RawImageHeader) + stride*height, true, true)) return false;
+
+	RawImageHeader& h = *reinterpret_cast<RawImageHeader*>(m_base);
+	memset(&h, 0, sizeof(h));
+	memcpy(h.m_magic, RawMagic, sizeof(RawMagic));
+	h.m_version = RawVersion;
+	h.m_width = width;
+	h.m_height = height;
+	h.m_stride = stride;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+void RawImage::close() {
+#ifdef WIN32
+	if (m_base) UnmapViewOfFile(m_base);
+	if (m_mapping) CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+	m_mapping = nullptr;
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	if (m_base) munmap(m_base, m_size);
+	if (m_file >= 0) ::close(m_file);
+	m_file = -1;
+#endif
+	m_base = nullptr;
+	m_size = 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// converts image to 32 bit BGRA and writes it as raw image file
+bool saveRawImage(const fipImage& image, const char* fileName) {
+	fipImage bgra(image);
+	if (!bgra.isValid() || (bgra.getBitsPerPixel() != 32 && !bgra.convertTo32Bits())) return false;
+
+	RawImage raw;
+	if (!raw.create(fileName, bgra.getWidth(), bgra.getHeight())) return false;
+
+	const size_t rowSize = 4*(size_t)bgra.getWidth();
+	for (int v = 0; v < raw.getHeight(); v++) {
+		memcpy(raw.getScanLine(v), bgra.getScanLine(v), rowSize);
+		memset(raw.getScanLine(v) + rowSize, 0, raw.getStride() - rowSize);
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// reads a raw image file into a 32 bit FreeImage image, which can be saved in any FreeImage format
+bool loadRawImage(const char* fileName, fipImage& image) {
+	RawImage raw;
+	if (!raw.open(fileName) || !image.setSize(FIT_BITMAP, raw.getWidth(), raw.getHeight(), 32)) return false;
+
+	const size_t rowSize = 4*(size_t)raw.getWidth();
+	for (int v = 0; v < raw.getHeight(); v++) {
+		memcpy(image.getScanLine(v), raw.getScanLine(v), rowSize);
+	}
+	return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include "main.h"
+
+////////////////////////////////////////////////////////////////////////
+// Raw BGRA image file: a 64 byte header followed by the scanlines in FreeImage order (bottom-up).
+// The stride is a multiple of 64 bytes, so every scanline is cache-line aligned in the memory mapped file
+// and the pixels can be passed to the filters without decoding or copying.
+struct RawImageHeader {
+	char m_magic[4];		// "BGRA"
+	uint32_t m_version;
+	uint32_t m_width;
+	uint32_t m_height;
+	uint64_t m_stride;		// bytes per scanline
+	uint8_t m_reserved[40];
+};
+
+static_assert(sizeof(RawImageHeader) == 64, "raw image header must be 64 bytes");
+
+////////////////////////////////////////////////////////////////////////
+// memory mapped raw image file
+class RawImage {
+	BYTE *m_base;			// mapped file
+	size_t m_size;			// mapped bytes
+#ifdef WIN32
+	void *m_file;
+	void *m_mapping;
+#else
+	int m_file;
+#endif
+
+	bool map(const char* fileName, size_t size, bool writable, bool create);
+
+public:
+	RawImage();
+	~RawImage();
+	RawImage(const RawImage&) = delete;
+	RawImage& operator=(const RawImage&) = delete;
+
+	// maps an existing raw image file
+	bool open(const char* fileName, bool writable = false);
+	// creates and maps a raw image file of the given size; the pixels are undefined
+	bool create(const char* fileName, int width, int height);
+	void close();
+
+	bool isValid() const { return m_base != nullptr; }
+	int getWidth() const { return header().m_width; }
+	int getHeight() const { return header().m_height; }
+	size_t getStride() const { return (size_t)header().m_stride; }
+	BYTE* getBits() const { return m_base + sizeof(RawImageHeader); }
+	BYTE* getScanLine(int v) const { return getBits() + v*getStride(); }
+
+private:
+	const RawImageHeader& header() const { return *reinterpret_cast<const RawImageHeader*>(m_base); }
+};
+
+////////////////////////////////////////////////////////////////////////
+// converters between FreeImage formats and raw image files
+bool saveRawImage(const fipImage& image, const char* fileName);
+bool loadRawImage(const char* fileName, fipImage& image);
@@ -0,0 +1,108 @@
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <omp.h>
+#include "main.h"
+#include "magnitude.h"
+#include "filters.h"
+
+////////////////////////////////////////////////////////////////////////
+// Running-sum edge detection for arbitrary odd filter sizes.
+// The horizontal filter is the box sum of the row above minus the box sum of the row below,
+// the vertical filter is the box sum of the left column minus the box sum of the right column.
+// Row box sums slide along the row and column box sums slide down the image,
+// so each pixel costs O(1) independent of fSize.
+
+////////////////////////////////////////////////////////////////////////
+// box sums over fSize pixels of one scanline for u in [fSizeD2, w - fSizeD2)
+static void rowBoxSums(const BYTE *scanLine, int w, int fSize, int *sums) {
+	const RGBQUAD *iC = reinterpret_cast<const RGBQUAD*>(scanLine);
+	const int fSizeD2 = fSize/2;
+	int s[3] = { 0, 0, 0 };
+
+	for (int i = 0; i < fSize; i++) {
+		s[0] += iC[i].rgbBlue;
+		s[1] += iC[i].rgbGreen;
+		s[2] += iC[i].rgbRed;
+	}
+	for (int u = fSizeD2; ; u++) {
+		int *sum = sums + 3*u;
+		sum[0] = s[0];
+		sum[1] = s[1];
+		sum[2] = s[2];
+		if (u + fSizeD2 + 1 >= w) break;
+
+		const RGBQUAD& in = iC[u + fSizeD2 + 1];
+		const RGBQUAD& out = iC[u - fSizeD2];
+		s[0] += in.rgbBlue - out.rgbBlue;
+		s[1] += in.rgbGreen - out.rgbGreen;
+		s[2] += in.rgbRed - out.rgbRed;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// adds sign times one scanline to the column box sums
+static void addRow(const BYTE *scanLine, int w, int sign, int *colSums) {
+	const RGBQUAD *iC = reinterpret_cast<const RGBQUAD*>(scanLine);
+
+	for (int u = 0; u < w; u++, colSums += 3) {
+		colSums[0] += sign*iC[u].rgbBlue;
+		colSums[1] += sign*iC[u].rgbGreen;
+		colSums[2] += sign*iC[u].rgbRed;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+void processRunningSum(const fipImage& input, fipImage& output, int fSize, Border border) {
+	const int bypp = 4;
+	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
+	assert(input.getBitsPerPixel() == bypp*8);
+	assert(fSize >= 3 && (fSize & 1) == 1);
+
+	const int w = input.getWidth();
+	const int h = input.getHeight();
+	const int fSizeD2 = fSize/2;
+
+	// the border needs the full filter tables, which are not available at compile time for arbitrary sizes
+	vector<int> hFilter(fSize*fSize), vFilter(fSize*fSize);
+	for (int j = 0; j < fSize; j++) {
+		for (int i = 0; i < fSize; i++) {
+			hFilter[j*fSize + i] = hTap(fSize, j, i);
+			vFilter[j*fSize + i] = vTap(fSize, j, i);
+		}
+	}
+	processBorder(input, output, hFilter.data(), vFilter.data(), fSize, border);
+	if (w < fSize || h < fSize) return;
+
+	#pragma omp parallel
+	{
+		// each thread processes a contiguous band of rows, so the column sums can slide down
+		const int nThreads = omp_get_num_threads();
+		const int rows = h - 2*fSizeD2;
+		const int v0 = fSizeD2 + (int)((long long)rows*omp_get_thread_num()/nThreads);
+		const int v1 = fSizeD2 + (int)((long long)rows*(omp_get_thread_num() + 1)/nThreads);
+		vector<int> colSums(3*w, 0), above(3*w), below(3*w);
+
+		if (v0 < v1) {
+			for (int j = v0 - fSizeD2; j <= v0 + fSizeD2; j++) addRow(input.getScanLine(j), w, 1, colSums.data());
+		}
+		for (int v = v0; v < v1; v++) {
+			if (v > v0) {
+				addRow(input.getScanLine(v + fSizeD2), w, 1, colSums.data());
+				addRow(input.getScanLine(v - fSizeD2 - 1), w, -1, colSums.data());
+			}
+			rowBoxSums(input.getScanLine(v - 1), w, fSize, above.data());
+			rowBoxSums(input.getScanLine(v + 1), w, fSize, below.data());
+
+			RGBQUAD *oC = reinterpret_cast<RGBQUAD*>(output.getScanLine(v)) + fSizeD2;
+			for (int u = fSizeD2; u < w - fSizeD2; u++, oC++) {
+				const int *a = &above[3*u], *b = &below[3*u];
+				const int *l = &colSums[3*(u - 1)], *r = &colSums[3*(u + 1)];
+				const int hC[3] = { a[0] - b[0], a[1] - b[1], a[2] - b[2] };
+				const int vC[3] = { l[0] - r[0], l[1] - r[1], l[2] - r[2] };
+
+				storeMagnitude(hC, vC, oC);
+			}
+		}
+	}
+}
@@ -0,0 +1,150 @@
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <vector>
+#include <algorithm>
+#include "main.h"
+
+////////////////////////////////////////////////////////////////////////
+// Strip streaming for images that do not fit into memory several times.
+// FreeImage can only decode whole images, so streaming works on binary PPM (P6) files, whose rows can be read
+// and written sequentially. Each output strip of stripHeight rows is filtered from an input window with fSize/2
+// additional rows above and below; the window slides down the image, so the memory stays bounded by a few strips.
+// The strips are oriented like FreeImage scanlines (bottom-up) to produce exactly the results of whole images.
+
+////////////////////////////////////////////////////////////////////////
+static bool readToken(FILE *f, int& value) {
+	int c = fgetc(f);
+
+	// skip white space and comments
+	while (c != EOF && (isspace(c) || c == '#')) {
+		if (c == '#') while (c != EOF && c != '\n') c = fgetc(f);
+		c = fgetc(f);
+	}
+	if (!isdigit(c)) return false;
+
+	value = 0;
+	while (isdigit(c)) {
+		value = 10*value + (c - '0');
+		c = fgetc(f);
+	}
+	// exactly one white space character separates the header from the pixel data
+	return c != EOF && isspace(c);
+}
+
+////////////////////////////////////////////////////////////////////////
+static bool readPPMHeader(FILE *f, int& w, int& h) {
+	int maxVal;
+
+	if (fgetc(f) != 'P' || fgetc(f) != '6') return false;
+	return readToken(f, w) && readToken(f, h) && readToken(f, maxVal) && w > 0 && h > 0 && maxVal == 255;
+}
+
+////////////////////////////////////////////////////////////////////////
+// RGB rows of the window (top-down) to a BGRA image (bottom-up)
+static void rgbToImage(const BYTE *rgb, int w, fipImage& image) {
+	const int h = image.getHeight();
+
+	#pragma omp parallel for
+	for (int r = 0; r < h; r++) {
+		const BYTE *iPos = rgb + (size_t)3*w*r;
+		RGBQUAD *oC = reinterpret_cast<RGBQUAD*>(image.getScanLine(h - 1 - r));
+
+		for (int u = 0; u < w; u++, iPos += 3, oC++) {
+			oC->rgbRed = iPos[0];
+			oC->rgbGreen = iPos[1];
+			oC->rgbBlue = iPos[2];
+			oC->rgbReserved = 255;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// rows [r0, r1) of a BGRA image (bottom-up) to top-down RGB rows
+static void imageToRgb(const fipImage& image, int r0, int r1, BYTE *rgb) {
+	const int w = image.getWidth();
+	const int h = image.getHeight();
+
+	#pragma omp parallel for
+	for (int r = r0; r < r1; r++) {
+		const RGBQUAD *iC = reinterpret_cast<const RGBQUAD*>(image.getScanLine(h - 1 - r));
+		BYTE *oPos = rgb + (size_t)3*w*(r - r0);
+
+		for (int u = 0; u < w; u++, iC++, oPos += 3) {
+			oPos[0] = iC->rgbRed;
+			oPos[1] = iC->rgbGreen;
+			oPos[2] = iC->rgbBlue;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// Filters the binary PPM inName strip by strip and writes the binary PPM outName.
+// Wrap borders would need the rows of the opposite image border and are not supported.
+bool processStreaming(const char* inName, const char* outName, int fSize, int stripHeight, const ImageFilter& filter) {
+	FILE *in = fopen(inName, "rb");
+	if (!in) {
+		cerr << "Image not found: " << inName << endl;
+		return false;
+	}
+	int w, h;
+	if (!readPPMHeader(in, w, h)) {
+		cerr << "Not a binary PPM (P6) with 8 bit channels: " << inName << endl;
+		fclose(in);
+		return false;
+	}
+	FILE *out = fopen(outName, "wb");
+	if (!out) {
+		cerr << "Image not saved: " << outName << endl;
+		fclose(in);
+		return false;
+	}
+	fprintf(out, "P6\n%d %d\n255\n", w, h);
+
+	const int fSizeD2 = fSize/2;
+	const size_t rowSize = (size_t)3*w;
+	const int windowHeight = stripHeight + 2*fSizeD2;
+	const double MB = 1024*1024;
+	cout << w << " x " << h << " image, " << stripHeight << " rows per strip: " << (rowSize*(windowHeight + stripHeight) + (size_t)2*4*w*windowHeight)/MB
+		<< " MB buffers instead of " << (size_t)4*4*w*h/MB << " MB for whole images" << endl;
+	vector<BYTE> window(rowSize*windowHeight);	// RGB input rows [w0, w1) of the current strip
+	vector<BYTE> strip(rowSize*stripHeight);	// RGB output rows of the current strip
+	fipImage input, output;
+	int w0 = 0, w1 = 0;
+	bool ok = true;
+
+	for (int y0 = 0; y0 < h && ok; y0 += stripHeight) {
+		const int y1 = min(y0 + stripHeight, h);
+		const int r0 = max(y0 - fSizeD2, 0);
+		const int r1 = min(y1 + fSizeD2, h);
+
+		// slide the window: keep the overlapping rows and read the new ones
+		if (r0 > w0) {
+			memmove(window.data(), window.data() + rowSize*(r0 - w0), rowSize*(w1 - r0));
+			w0 = r0;
+		}
+		if (fread(window.data() + rowSize*(w1 - w0), rowSize, r1 - w1, in) != (size_t)(r1 - w1)) {
+			cerr << "Unexpected end of file: " << inName << endl;
+			ok = false;
+			break;
+		}
+		w1 = r1;
+
+		// filter the window and write the rows of the strip
+		if ((int)input.getHeight() != r1 - r0) {
+			input.setSize(FIT_BITMAP, w, r1 - r0, 32);
+			output.setSize(FIT_BITMAP, w, r1 - r0, 32);
+		}
+		rgbToImage(window.data(), w, input);
+		filter(input, output);
+		imageToRgb(output, y0 - r0, y1 - r0, strip.data());
+		ok = fwrite(strip.data(), rowSize, y1 - y0, out) == (size_t)(y1 - y0);
+	}
+
+	fclose(in);
+	if (fclose(out) != 0 || !ok) {
+		cerr << "Image not saved: " << outName << endl;
+		return false;
+	}
+	return true;
+}
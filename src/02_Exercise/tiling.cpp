@@ -0,0 +1,45 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "main.h"
+
+////////////////////////////////////////////////////////////////////////
+// Size of the (per core) L2 cache in bytes
+size_t getL2CacheSize() {
+	size_t size = 0;
+
+#ifdef WIN32
+	DWORD len = 0;
+	GetLogicalProcessorInformation(nullptr, &len);
+	vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(len/sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (!info.empty() && GetLogicalProcessorInformation(info.data(), &len)) {
+		for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& i : info) {
+			if (i.Relationship == RelationCache && i.Cache.Level == 2) {
+				size = i.Cache.Size;
+				break;
+			}
+		}
+	}
+#elif defined(_SC_LEVEL2_CACHE_SIZE)
+	const long s = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (s > 0) size = s;
+#endif
+	return size ? size : 256*1024; // conservative default
+}
+
+////////////////////////////////////////////////////////////////////////
+// Tile size in pixels such that the input tile with its fSize/2 halo and the output tile
+// use about half of the L2 cache. The tile width is a multiple of a cache line (16 pixels).
+void getTileSize(size_t cacheSize, int fSize, int& tileW, int& tileH) {
+	const int bypp = 4;
+	const int fSizeD2 = fSize/2;
+	const int side = (int)sqrt((double)cacheSize/2/(2*bypp)); // input and output tile
+
+	tileW = max(16, (side - 2*fSizeD2) & ~15);
+	tileH = max(8, side - 2*fSizeD2);
+}
@@ -0,0 +1,159 @@
+#include <cmath>
+#include <algorithm>
+#include "main.h"
+#include "magnitude.h"
+#include "filters.h"
+
+////////////////////////////////////////////////////////////////////////
+// Edge detection in the pixel format of the input: 8 bit BGR(A), 16 bit grayscale, RGB(A) and
+// float grayscale, RGB(A) images are filtered without a conversion to 8 bit BGRA.
+// The kernels are specialized for the sample type T, the number of samples per pixel
+// and the number of filtered color channels; further samples (alpha) are set to the maximum.
+
+////////////////////////////////////////////////////////////////////////
+// accumulator type and magnitude per sample type
+template<typename T> struct PixelTraits;
+
+template<> struct PixelTraits<BYTE> {
+	typedef int Acc;
+	static BYTE maxValue() { return 255; }
+	static BYTE magnitude(int x, int y) { return ::magnitude(x, y); }
+};
+
+template<> struct PixelTraits<WORD> {
+	// 16 bit samples times the weights of a filter table fit into 32 bit
+	typedef int Acc;
+	static WORD maxValue() { return 65535; }
+	static WORD magnitude(int x, int y) {
+		// the sum of squares needs 64 bit; the double square root is exact below 65535^2
+		const long long n = (long long)x*x + (long long)y*y;
+		return (n >= 65535LL*65535) ? 65535 : (WORD)sqrt((double)n);
+	}
+};
+
+template<> struct PixelTraits<float> {
+	typedef float Acc;
+	static float maxValue() { return 1.0f; }
+	static float magnitude(float x, float y) { return sqrtf(x*x + y*y); }
+};
+
+////////////////////////////////////////////////////////////////////////
+template<typename T, typename Acc, size_t... C>
+inline void storeChannels(const Acc hC[], const Acc vC[], T *oC, index_sequence<C...>) {
+	((oC[C] = PixelTraits<T>::magnitude(hC[C], vC[C])), ...);
+}
+
+template<typename T, int PixelSize, int Channels>
+inline void storePixel(const typename PixelTraits<T>::Acc hC[], const typename PixelTraits<T>::Acc vC[], T *oC) {
+	storeChannels(hC, vC, oC, make_index_sequence<Channels>());
+	for (int c = Channels; c < PixelSize; c++) oC[c] = PixelTraits<T>::maxValue();
+}
+
+// BGRA: all three magnitudes at once
+template<>
+inline void storePixel<BYTE, 4, 3>(const int hC[], const int vC[], BYTE *oC) {
+	storeMagnitude(hC, vC, reinterpret_cast<RGBQUAD*>(oC));
+}
+
+////////////////////////////////////////////////////////////////////////
+// computes the fSize/2 wide image frame with remapped coordinates (see border.cpp)
+template<typename T, int PixelSize, int Channels>
+static void processFrame(const BYTE *input, BYTE *output, int w, int h, size_t stride, const int *hFilter, const int *vFilter, int fSize, Border border) {
+	typedef typename PixelTraits<T>::Acc Acc;
+	const int fSizeD2 = fSize/2;
+
+	#pragma omp parallel for
+	for (int v = 0; v < h; v++) {
+		const bool frameRow = v < fSizeD2 || v >= h - fSizeD2;
+
+		for (int u = 0; u < w; u++) {
+			// inner pixels of inner rows are computed by the kernel
+			if (!frameRow && u == fSizeD2) u = max(u, w - fSizeD2);
+			if (u >= w) break;
+
+			Acc hC[Channels] = {}, vC[Channels] = {};
+			for (int j = 0; j < fSize; j++) {
+				const int y = remap(v + j - fSizeD2, h, border);
+				for (int i = 0; i < fSize; i++) {
+					const int hf = hFilter[j*fSize + i], vf = vFilter[j*fSize + i];
+					const int x = remap(u + i - fSizeD2, w, border);
+					if ((hf == 0 && vf == 0) || x < 0 || y < 0) continue;
+
+					const T *iC = reinterpret_cast<const T*>(input + y*stride) + PixelSize*x;
+					for (int c = 0; c < Channels; c++) {
+						if (hf != 0) hC[c] += hf*iC[c];
+						if (vf != 0) vC[c] += vf*iC[c];
+					}
+				}
+			}
+			storePixel<T, PixelSize, Channels>(hC, vC, reinterpret_cast<T*>(output + v*stride) + PixelSize*u);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// specialized for the pixel format and the filter size (see Convolution)
+template<typename T, int PixelSize, int Channels, int FSize>
+static void processPixels(const BYTE *input, BYTE *output, int w, int h, size_t stride, Border border) {
+	typedef typename PixelTraits<T>::Acc Acc;
+	const int fSizeD2 = FSize/2;
+
+	#pragma omp parallel for
+	for(int v = fSizeD2; v < h - fSizeD2; v++) {
+		const BYTE *iPos = input + (v - fSizeD2)*stride;
+		T *oC = reinterpret_cast<T*>(output + v*stride) + PixelSize*fSizeD2;
+
+		for(int u = fSizeD2; u < w - fSizeD2; u++) {
+			Acc hC[Channels] = {}, vC[Channels] = {};
+
+			Convolution<FSize>::template apply<T, PixelSize, Channels>(iPos, stride, hC, vC);
+
+			storePixel<T, PixelSize, Channels>(hC, vC, oC);
+			iPos += sizeof(T)*PixelSize;
+			oC += PixelSize;
+		}
+	}
+	processFrame<T, PixelSize, Channels>(input, output, w, h, stride, EdgeFilter<FSize>::tables.h, EdgeFilter<FSize>::tables.v, FSize, border);
+}
+
+////////////////////////////////////////////////////////////////////////
+typedef void (*PixelKernel)(const BYTE *input, BYTE *output, int w, int h, size_t stride, Border border);
+
+template<typename T, int PixelSize, int Channels>
+static PixelKernel getKernel(int fSize) {
+	switch(fSize) {
+	case 3: return processPixels<T, PixelSize, Channels, 3>;
+	case 5: return processPixels<T, PixelSize, Channels, 5>;
+	case 7: return processPixels<T, PixelSize, Channels, 7>;
+	case 9: return processPixels<T, PixelSize, Channels, 9>;
+	case 11: return processPixels<T, PixelSize, Channels, 11>;
+	default: return nullptr;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// Returns false (and leaves output unchanged) if the pixel format or the filter size is not supported
+bool processTyped(const fipImage& input, fipImage& output, int fSize, Border border) {
+	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
+	assert(input.getImageType() == output.getImageType() && input.getBitsPerPixel() == output.getBitsPerPixel());
+
+	PixelKernel kernel = nullptr;
+
+	switch(input.getImageType()) {
+	case FIT_BITMAP:
+		if (input.getBitsPerPixel() == 32) kernel = getKernel<BYTE, 4, 3>(fSize);
+		else if (input.getBitsPerPixel() == 24) kernel = getKernel<BYTE, 3, 3>(fSize);
+		break;
+	case FIT_UINT16: kernel = getKernel<WORD, 1, 1>(fSize); break;
+	case FIT_RGB16: kernel = getKernel<WORD, 3, 3>(fSize); break;
+	case FIT_RGBA16: kernel = getKernel<WORD, 4, 3>(fSize); break;
+	case FIT_FLOAT: kernel = getKernel<float, 1, 1>(fSize); break;
+	case FIT_RGBF: kernel = getKernel<float, 3, 3>(fSize); break;
+	case FIT_RGBAF: kernel = getKernel<float, 4, 3>(fSize); break;
+	default: break;
+	}
+	if (!kernel) return false;
+
+	kernel(input.getScanLine(0), output.getScanLine(0), input.getWidth(), input.getHeight(), input.getScanWidth(), border);
+	return true;
+}
@@ -6,11 +6,47 @@ uint dist(int x, int y) {
 
 ////////////////////////////////////////////////////////////////////////
 // OpenCL kernel
-__kernel void edges(__read_only image2d_t source, __write_only image2d_t dest, __constant int* hFilter, __constant int* vFilter, int fSize, sampler_t sampler) {
-	const int w = get_global_size(0);
-	const int h = get_global_size(1);
+// Each work-group reads its tile plus a halo of fSize/2 pixels once into local memory (tile),
+// the filter taps are then read from local memory instead of fSize^2 image reads per pixel.
+// The global size is rounded up to multiples of the work-group size, so w and h are passed explicitly.
+// The sampler clamps the halo to the image.
+__kernel void edges(__read_only image2d_t source, __write_only image2d_t dest, __constant int* hFilter, __constant int* vFilter, int fSize, sampler_t sampler, int w, int h, __local uchar4* tile) {
+	const int x = get_global_id(0);
+	const int y = get_global_id(1);
+	const int lx = get_local_id(0);
+	const int ly = get_local_id(1);
+	const int lw = get_local_size(0);
+	const int lh = get_local_size(1);
+	const int fSizeD2 = fSize/2;
+	const int tw = lw + 2*fSizeD2;
+	const int th = lh + 2*fSizeD2;
+	const int x0 = get_group_id(0)*lw - fSizeD2;
+	const int y0 = get_group_id(1)*lh - fSizeD2;
 
-	// TODO implement edge detection using vector operations
-	// use read_imageui(...) and write_imageui(...) to read/write one pixel of source/dest
+	// all work-items of the group load the tile together
+	for (int j = ly; j < th; j += lh) {
+		for (int i = lx; i < tw; i += lw) {
+			tile[j*tw + i] = convert_uchar4(read_imageui(source, sampler, (int2)(x0 + i, y0 + j)));
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (x >= w || y >= h) return;
+
+	// all color channels at once
+	int4 hC = 0;
+	int4 vC = 0;
+	int fi = 0;
+
+	for (int j = 0; j < fSize; j++) {
+		__local const uchar4 *row = tile + (ly + j)*tw + lx;
+
+		for (int i = 0; i < fSize; i++, fi++) {
+			const int4 c = convert_int4(row[i]);
+
+			hC += hFilter[fi]*c;
+			vC += vFilter[fi]*c;
+		}
+	}
+	write_imageui(dest, (int2)(x, y), (uint4)(dist(hC.x, vC.x), dist(hC.y, vC.y), dist(hC.z, vC.z), 255));
 }
 
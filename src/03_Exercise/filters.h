@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include "FreeImagePlus.h"
+
+////////////////////////////////////////////////////////////////////////
+// Edge filters of size fSize x fSize generated at compile time:
+// hFilter has a row of ones above and a row of minus ones below the center,
+// vFilter has a column of ones left and a column of minus ones right of the center
+constexpr int hTap(int fSize, int j, int /*i*/) {
+	return (j == fSize/2 - 1) ? 1 : (j == fSize/2 + 1) ? -1 : 0;
+}
+
+constexpr int vTap(int fSize, int /*j*/, int i) {
+	return (i == fSize/2 - 1) ? 1 : (i == fSize/2 + 1) ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// row-major filter tables
+template<int FSize>
+struct FilterTables {
+	int h[FSize*FSize];
+	int v[FSize*FSize];
+};
+
+template<int FSize>
+constexpr FilterTables<FSize> makeFilterTables() {
+	FilterTables<FSize> t = {};
+
+	for (int j = 0; j < FSize; j++) {
+		for (int i = 0; i < FSize; i++) {
+			t.h[j*FSize + i] = hTap(FSize, j, i);
+			t.v[j*FSize + i] = vTap(FSize, j, i);
+		}
+	}
+	return t;
+}
+
+template<int FSize>
+struct EdgeFilter {
+	static constexpr FilterTables<FSize> tables = makeFilterTables<FSize>();
+};
+
+template<int FSize>
+constexpr FilterTables<FSize> EdgeFilter<FSize>::tables;
+
+////////////////////////////////////////////////////////////////////////
+// Fully unrolled convolution of one pixel: tap K of the filters is resolved at compile time,
+// so zero taps produce no code at all
+template<int FSize, int K = 0>
+struct Convolution {
+	static void apply(const BYTE *iPos, size_t stride, int hC[3], int vC[3]) {
+		constexpr int hf = EdgeFilter<FSize>::tables.h[K];
+		constexpr int vf = EdgeFilter<FSize>::tables.v[K];
+
+		if (hf != 0 || vf != 0) {
+			const RGBQUAD *iC = reinterpret_cast<const RGBQUAD*>(iPos + (K/FSize)*stride) + K%FSize;
+
+			hC[0] += hf*iC->rgbBlue;
+			hC[1] += hf*iC->rgbGreen;
+			hC[2] += hf*iC->rgbRed;
+			vC[0] += vf*iC->rgbBlue;
+			vC[1] += vf*iC->rgbGreen;
+			vC[2] += vf*iC->rgbRed;
+		}
+		Convolution<FSize, K + 1>::apply(iPos, stride, hC, vC);
+	}
+};
+
+template<int FSize>
+struct Convolution<FSize, FSize*FSize> {
+	static void apply(const BYTE *, size_t, int [3], int [3]) {}
+};
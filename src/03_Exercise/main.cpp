@@ -1,12 +1,15 @@
 #include "main.h"
 #include "ocl.h"
+#include "filters.h"
 
 ////////////////////////////////////////////////////////////////////////
 // prototypes
-OCLData initOCL(const char* kernelFileName, const char* kernelName);
+OCLData initOCL(const char* kernelFileName, const char* kernelName, const char* device);
+void printProfile(const OCLData& ocl);
 void processOCL(OCLData& ocl, const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize);
 void processAMP(const fipImage& input, fipImage& output, const int* hFilter, const int* vFilter, int fSize, Stopwatch& sw);
 void processACC(const fipImage& input, fipImage& output, const int* hFilter, const int* vFilter, int fSize);
+bool processSeparable(const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize);
 
 ////////////////////////////////////////////////////////////////////////
 static BYTE dist(int x, int y) {
@@ -15,53 +18,54 @@ static BYTE dist(int x, int y) {
 }
 
 ////////////////////////////////////////////////////////////////////////
-static void processParallel(const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize) {
+// specialized for each filter size: the filter taps are compile-time constants (see Convolution)
+template<int FSize>
+static void processParallel(const fipImage& input, fipImage& output) {
 	const int bypp = 4;
 	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
 	assert(input.getBitsPerPixel() == bypp*8);
 
 	const size_t stride = input.getScanWidth();
-	const int fSizeD2 = fSize/2;
+	const int fSizeD2 = FSize/2;
 
 	#pragma omp parallel for
 	for(int v = fSizeD2; v < (int)output.getHeight() - fSizeD2; v++) {
-		BYTE *iCenter = input.getScanLine(v) + bypp*fSizeD2;
+		const BYTE *iPos = input.getScanLine(v - fSizeD2);
 		BYTE *oPos = output.getScanLine(v) + bypp*fSizeD2;
 
 		for(size_t u = fSizeD2; u < output.getWidth() - fSizeD2; u++) {
 			int hC[3] = { 0, 0, 0 };
 			int vC[3] = { 0, 0, 0 };
-			int fi = 0;
-			BYTE *iPos = iCenter - fSizeD2*stride - bypp*fSizeD2;
 
-			for(int j = 0; j < fSize; j++) {
-				for(int i = 0; i < fSize; i++) {
-					const RGBQUAD *iC = reinterpret_cast<RGBQUAD*>(iPos);
-					int f = hFilter[fi];
+			Convolution<FSize>::apply(iPos, stride, hC, vC);
 
-					hC[0] += f*iC->rgbBlue;
-					hC[1] += f*iC->rgbGreen;
-					hC[2] += f*iC->rgbRed;
-					f = vFilter[fi];
-					vC[0] += f*iC->rgbBlue;
-					vC[1] += f*iC->rgbGreen;
-					vC[2] += f*iC->rgbRed;
-					iPos += bypp;
-					fi++;
-				}
-				iPos += stride - bypp*fSize;
-			}
 			RGBQUAD *oC = reinterpret_cast<RGBQUAD*>(oPos);
 			oC->rgbBlue = dist(hC[0], vC[0]);
 			oC->rgbGreen = dist(hC[1], vC[1]);
 			oC->rgbRed = dist(hC[2], vC[2]);
 			oC->rgbReserved = 255;
-			iCenter += bypp;
+			iPos += bypp;
 			oPos += bypp;
 		}
 	}
 }
 
+////////////////////////////////////////////////////////////////////////
+// filter tables and specialized OpenMP kernel per filter size
+struct FilterEntry {
+	const int *hFilter;
+	const int *vFilter;
+	void (*processParallel)(const fipImage& input, fipImage& output);
+};
+
+static const FilterEntry filterEntries[] = {
+	{ EdgeFilter<3>::tables.h, EdgeFilter<3>::tables.v, processParallel<3> },
+	{ EdgeFilter<5>::tables.h, EdgeFilter<5>::tables.v, processParallel<5> },
+	{ EdgeFilter<7>::tables.h, EdgeFilter<7>::tables.v, processParallel<7> },
+	{ EdgeFilter<9>::tables.h, EdgeFilter<9>::tables.v, processParallel<9> },
+	{ EdgeFilter<11>::tables.h, EdgeFilter<11>::tables.v, processParallel<11> },
+};
+
 ////////////////////////////////////////////////////////////////////////
 static bool equals(const fipImage& im1, const fipImage& im2, int fSize) {
 	assert(im1.getWidth() == im2.getWidth() && im1.getHeight() == im2.getHeight() && im1.getImageSize() == im2.getImageSize());
@@ -81,7 +85,8 @@ static bool equals(const fipImage& im1, const fipImage& im2, int fSize) {
 ////////////////////////////////////////////////////////////////////////
 int main(int argc, const char* argv[]) {
 	if (argc < 4) {
-		cerr << "Usage: " << argv[0] << " filter-size input-file-name output-file-name" << endl;
+		cerr << "Usage: " << argv[0] << " filter-size input-file-name output-file-name [gpu|cpu|accelerator|all|device-index|device-name]" << endl;
+		cerr << "       the OpenCL device can also be selected with the environment variable OCL_DEVICE, by default the GPUs are used" << endl;
 		return -1;
 	}
 	int fSize = atoi(argv[1]);
@@ -98,148 +103,47 @@ int main(int argc, const char* argv[]) {
 		return -3;
 	}
 
-	const int hFilter3[] = {
-		1, 1, 1,
-		0, 0, 0,
-	   -1,-1,-1,
-	};
-	const int vFilter3[] = {
-		1, 0,-1,
-		1, 0,-1,
-		1, 0,-1,
-	};
-	const int hFilter5[] = {
-		0, 0, 0, 0, 0,
-		1, 1, 1, 1, 1,
-		0, 0, 0, 0, 0,
-	   -1,-1,-1,-1,-1,
-	    0, 0, 0, 0, 0,
-	};
-	const int vFilter5[] = {
-		0, 1, 0,-1, 0,
-		0, 1, 0,-1, 0,
-		0, 1, 0,-1, 0,
-		0, 1, 0,-1, 0,
-		0, 1, 0,-1, 0,
-	};
-	const int hFilter7[] = {
-		0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0,
-		1, 1, 1, 1, 1, 1, 1,
-		0, 0, 0, 0, 0, 0, 0,
-	   -1,-1,-1,-1,-1,-1,-1,
-	    0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0,
-	};
-	const int vFilter7[] = {
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-		0, 0, 1, 0,-1, 0, 0,
-	};
-	const int hFilter9[] = {
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-		1, 1, 1, 1, 1, 1, 1, 1, 1,
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-	   -1,-1,-1,-1,-1,-1,-1,-1,-1,
-	    0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0,
-	};
-	const int vFilter9[] = {
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-		0, 0, 0, 1, 0,-1, 0, 0, 0,
-	};
-	const int hFilter11[] = {
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	   -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
-	    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-	};
-	const int vFilter11[] = {
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-		0, 0, 0, 0, 1, 0,-1, 0, 0, 0, 0,
-	};
-
 	Stopwatch sw;
 	double parTime;
-	const int *hFilter;
-	const int *vFilter;
-
-	switch(fSize) {
-	case 3:
-		hFilter = hFilter3;
-		vFilter = vFilter3;
-		break;
-	case 5:
-		hFilter = hFilter5;
-		vFilter = vFilter5;
-		break;
-	case 7:
-		hFilter = hFilter7;
-		vFilter = vFilter7;
-		break;
-	case 9:
-		hFilter = hFilter9;
-		vFilter = vFilter9;
-		break;
-	case 11:
-		hFilter = hFilter11;
-		vFilter = vFilter11;
-		break;
-	}
+	const FilterEntry& filter = filterEntries[(fSize - 3)/2];
+	const int *hFilter = filter.hFilter;
+	const int *vFilter = filter.vFilter;
 
 	// create output images
-	fipImage out1(image), out2(image), out3(image);
+	fipImage out1(image), out2(image), out3(image), out4(image);
 
 	cout << "Edge detection with filter size " << fSize << endl << endl;
 
 	// process image on CPU in parallel and produce out1
 	cout << "Start OpenMP" << endl;
 	sw.Start();
-	processParallel(image, out1, hFilter, vFilter, fSize);
+	filter.processParallel(image, out1);
 	sw.Stop();
 	parTime = sw.GetElapsedTimeMilliseconds();
 	cout << parTime << " ms" << endl << endl;
+
+	// process image on CPU with separable filters and produce out4
+	cout << "Start separable OpenMP" << endl;
+	sw.Start();
+	if (processSeparable(image, out4, hFilter, vFilter, fSize)) {
+		sw.Stop();
+		cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << parTime/sw.GetElapsedTimeMilliseconds() << endl;
+		cout << boolalpha << "OpenMP and separable OpenMP produce the same results: " << equals(out1, out4, fSize) << endl << endl;
+	} else {
+		cout << "Filters are not separable" << endl << endl;
+	}
 	
-	// process image on GPU with OpenCL and produce out2
-	OCLData ocl = initOCL("..\\03_Exercise\\edges.cl", "edges");
-	cout << endl << "Start OpenCL on GPU" << endl;
+	// process image on the selected OpenCL device and produce out2
+	OCLData ocl = initOCL("..\\03_Exercise\\edges.cl", "edges", (argc > 4) ? argv[4] : nullptr);
+	cout << endl << "Start OpenCL on " << ocl.m_deviceName << endl;
 	sw.Start();
 	processOCL(ocl, image, out2, hFilter, vFilter, fSize);
 	sw.Stop();
 	cout << sw.GetElapsedTimeMilliseconds() << " ms, speedup = " << parTime/sw.GetElapsedTimeMilliseconds() << endl;
+	printProfile(ocl);
 
 	// compare out1 with out2
-	cout << boolalpha << "OpenMP and OpenCL on GPU produce the same results: " << equals(out1, out2, fSize) << endl << endl;
+	cout << boolalpha << "OpenMP and OpenCL produce the same results: " << equals(out1, out2, fSize) << endl << endl;
 
 	// process image on GPU with AMP/OpenACC and produce out3
 	cout << "Start AMP on GPU" << endl;
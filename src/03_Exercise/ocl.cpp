@@ -2,72 +2,175 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <cctype>
 #include "main.h"
 #include "ocl.h"
 
 ////////////////////////////////////////////////////////////////////////
-OCLData initOCL(const char* kernelFileName, const char* kernelName) {
-	OCLData ocl;
-	vector<cl::Platform> platforms;
-	vector<cl::Device> devices;
+// 64 bit FNV-1a hash
+static unsigned long long fnv1a(const string& s) {
+	unsigned long long hash = 14695981039346656037ULL;
 
-	cout << "**************************************************************************" << endl;
+	for(unsigned char c: s) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Builds the program for the first of the given devices with a binary cache: the binary of a source build is stored
+// next to the kernel file under a hash of source, build options, device name and driver version,
+// later runs load it with clCreateProgramWithBinary. A missing or rejected binary falls back to the source build.
+static cl::Program buildProgram(const cl::Context& context, const vector<cl::Device>& devices, const string& source, const char* options, const char* kernelFileName, bool& cached) {
+	// the cache key describes exactly one device, so the program is built for this device only
+	const vector<cl::Device> device(1, devices[0]);
+	string deviceName, driverVersion;
+	device[0].getInfo(CL_DEVICE_NAME, &deviceName);
+	device[0].getInfo(CL_DRIVER_VERSION, &driverVersion);
+
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx", fnv1a(source + '\0' + options + '\0' + deviceName + '\0' + driverVersion));
+	const string cacheName = string(kernelFileName) + "." + hash + ".bin";
+
+	ifstream in(cacheName, ios::binary);
+	if (in.good()) {
+		const vector<char> binary((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+		try {
+			cl::Program::Binaries binaries(1, make_pair(binary.data(), binary.size()));
+			cl::Program program(context, device, binaries);
+			program.build(device, options);
+			cached = true;
+			return program;
+		} catch(cl::Error&) {
+			// the binary does not fit the device or driver
+		}
+	}
+
+	cl::Program::Sources progSource(1, make_pair(source.c_str(), source.length() + 1));	// create source code object
+	cl::Program program(context, progSource);												// create program object
+	program.build(device, options);															// build the program for the device
+	cached = false;
+
+	// store the binary of the device; the cache is optional, so errors are ignored
 	try {
-		// discover all available platforms
-		cl::Platform::get(&platforms);
-		if (platforms.empty()) {
-			cerr << "Error: no OpenCL platform available" << endl;
-			return ocl;
+		// the program has one binary per device of the context, only the built device has one with non-zero size
+		const vector<cl::Device> programDevices = program.getInfo<CL_PROGRAM_DEVICES>();
+		const vector<size_t> sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+		const size_t d = find_if(programDevices.begin(), programDevices.end(), [&](const cl::Device& dev) { return dev() == device[0](); }) - programDevices.begin();
+
+		if (d < sizes.size() && sizes[d] > 0) {
+			vector<char> binary(sizes[d]);
+			vector<char*> binaries(sizes.size(), nullptr);	// null entries are skipped
+
+			binaries[d] = binary.data();
+			program.getInfo(CL_PROGRAM_BINARIES, &binaries);
+			ofstream out(cacheName, ios::binary);
+			out.write(binary.data(), binary.size());
 		}
+	} catch(cl::Error&) {
+		// the program stays usable without cache entry
+	}
+	return program;
+}
 
-		string name, profile, version;
-		
-		for(cl::Platform& p: platforms) {
-			p.getInfo(CL_PLATFORM_NAME, &name);
-			p.getInfo(CL_PLATFORM_PROFILE, &profile);
-			p.getInfo(CL_PLATFORM_VERSION, &version);
+////////////////////////////////////////////////////////////////////////
+// selection is "gpu", "cpu", "accelerator", "all", a device index in the listed order or a part of the device name
+static bool isSelected(const cl::Device& dev, int index, const string& selection) {
+	cl_device_type type;	dev.getInfo(CL_DEVICE_TYPE, &type);
+	string name;			dev.getInfo(CL_DEVICE_NAME, &name);
 
-			vector<cl::Device> devs;
+	if (selection == "all") return true;
+	if (selection == "gpu") return (type & CL_DEVICE_TYPE_GPU) != 0;
+	if (selection == "cpu") return (type & CL_DEVICE_TYPE_CPU) != 0;
+	if (selection == "accelerator") return (type & CL_DEVICE_TYPE_ACCELERATOR) != 0;
+	if (all_of(selection.begin(), selection.end(), [](char c) { return isdigit((unsigned char)c); })) return index == atoi(selection.c_str());
 
-			try {
-				// get GPUs of this platform
-				p.getDevices(CL_DEVICE_TYPE_GPU, &devs);
+	auto lower = [](string s) { transform(s.begin(), s.end(), s.begin(), [](char c) { return (char)tolower((unsigned char)c); }); return s; };
+	return lower(name).find(lower(selection)) != string::npos;
+}
 
-			} catch(cl::Error&) {
-				// there is no GPU on this platform
-			}
+////////////////////////////////////////////////////////////////////////
+// Shows all devices of all platforms and returns the selected ones. Without selection
+// the environment variable OCL_DEVICE is used and then the GPUs.
+static vector<cl::Device> findDevices(const char* device) {
+	vector<cl::Platform> platforms;
+	vector<cl::Device> selected;
+	const char* env = getenv("OCL_DEVICE");
+	const string selection = (device && *device) ? device : (env && *env) ? env : "gpu";
+
+	// discover all available platforms
+	cl::Platform::get(&platforms);
+	if (platforms.empty()) {
+		cerr << "Error: no OpenCL platform available" << endl;
+		return selected;
+	}
+
+	string name, profile, version;
+	int index = 0;
+
+	for(cl::Platform& p: platforms) {
+		p.getInfo(CL_PLATFORM_NAME, &name);
+		p.getInfo(CL_PLATFORM_PROFILE, &profile);
+		p.getInfo(CL_PLATFORM_VERSION, &version);
+
+		vector<cl::Device> devs;
+
+		try {
+			p.getDevices(CL_DEVICE_TYPE_ALL, &devs);
+
+		} catch(cl::Error&) {
+			// there is no device on this platform
+		}
+
+		if (!devs.empty()) {
+			// show platform
+			cout << "Platform " << name << " (" << version << ", " << profile << ")" << endl;
+
+			// discover all available devices on this platform
+			for(cl::Device& dev: devs) {
+				// get and show device information
+				const bool chosen = isSelected(dev, index, selection);
+				dev.getInfo(CL_DEVICE_NAME, &name);
+				cl_uint maxComputeUnits;		dev.getInfo(CL_DEVICE_MAX_COMPUTE_UNITS, &maxComputeUnits);
+				cl_uint maxDims;				dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, &maxDims);
+				vector<size_t> workitemSize;	dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_SIZES, &workitemSize);
+				size_t workgroupSize;			dev.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &workgroupSize); // product of all dimensions
+				cl_ulong localMemSize;			dev.getInfo(CL_DEVICE_LOCAL_MEM_SIZE, &localMemSize);
+				cout << "[" << index << "] " << name << (chosen ? " (selected)" : "") << endl;
+				cout << "Max. Compute Units: " << maxComputeUnits << ", Max. Dimensions: " << maxDims << " [" << workitemSize[0] << "," << workitemSize[1] << "," << workitemSize[2] << "]" << endl;
+				cout << "Max. Work Group Size: " << workgroupSize << ", Max. Local Mem Size: " << localMemSize << endl << endl;
 
-			if (!devs.empty()) {
-				// show platform
-				cout << "Platform " << name << " (" << version << ", " << profile << ")" << endl;
-
-				// discover all available GPUs on this platform
-				for(cl::Device& dev: devs) {
-					// get and show device information
-					dev.getInfo(CL_DEVICE_NAME, &name);
-					cl_uint maxComputeUnits;		dev.getInfo(CL_DEVICE_MAX_COMPUTE_UNITS, &maxComputeUnits);
-					cl_uint maxDims;				dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, &maxDims);
-					vector<size_t> workitemSize;	dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_SIZES, &workitemSize);
-					size_t workgroupSize;			dev.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &workgroupSize); // product of all dimensions
-					cl_ulong localMemSize;			dev.getInfo(CL_DEVICE_LOCAL_MEM_SIZE, &localMemSize);
-					cout << name << endl;
-					cout << "Max. Compute Units: " << maxComputeUnits << ", Max. Dimensions: " << maxDims << " [" << workitemSize[0] << "," << workitemSize[1] << "," << workitemSize[2] << "]" << endl;
-					cout << "Max. Work Group Size: " << workgroupSize << ", Max. Local Mem Size: " << localMemSize << endl << endl;
-				}
-
-				if (devices.empty()) {
-					// create s_context and command s_queue for the first GPU
-					cl::Device& dev = devs.front();
-					cl_context_properties cps[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)(p)(), 0 };
-
-					ocl.m_context = cl::Context(CL_DEVICE_TYPE_GPU, cps);
-					ocl.m_queue = cl::CommandQueue(ocl.m_context, dev);
-
-					// add first device
-					devices.push_back(dev);
-				}
+				if (chosen) selected.push_back(dev);
+				index++;
 			}
 		}
+	}
+	if (selected.empty()) {
+		cerr << "Error: no OpenCL device matches " << selection << endl;
+	}
+	return selected;
+}
+
+////////////////////////////////////////////////////////////////////////
+// first selected device, see findDevices
+OCLData initOCL(const char* kernelFileName, const char* kernelName, const char* device) {
+	OCLData ocl;
+
+	cout << "**************************************************************************" << endl;
+	try {
+		const vector<cl::Device> devices = findDevices(device);
+		if (devices.empty()) return ocl;
+
+		// create s_context and command s_queue for the first selected device
+		const vector<cl::Device> first(1, devices.front());
+		ocl.m_context = cl::Context(first);
+		ocl.m_queue = cl::CommandQueue(ocl.m_context, first.front(), CL_QUEUE_PROFILING_ENABLE);
+		first.front().getInfo(CL_DEVICE_NAME, &ocl.m_deviceName);
 
 		// read source file
 		ifstream file(kernelFileName);
@@ -77,11 +180,14 @@ OCLData initOCL(const char* kernelFileName, const char* kernelName) {
 		}
 		string prog(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));	// read in file and store it in string prog
 		file.close();
-		cl::Program::Sources progSource(1, make_pair(prog.c_str(), prog.length() + 1));	// create source code object
 
 		// compile and execute s_kernel code
-		cl::Program program(ocl.m_context, progSource);									// create program object
-		program.build(devices);															// build the program for given devices
+		Stopwatch sw;
+		bool cached;
+		sw.Start();
+		cl::Program program = buildProgram(ocl.m_context, first, prog, "", kernelFileName, cached);
+		sw.Stop();
+		cout << "Program " << (cached ? "loaded from binary cache" : "built from source") << " in " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
 		ocl.m_kernel = cl::Kernel(program, kernelName);									// create the s_kernel: must be the name of the s_kernel in the cl file
 
 	} catch(cl::Error& err) {
@@ -91,6 +197,74 @@ OCLData initOCL(const char* kernelFileName, const char* kernelName) {
 	return ocl;
 }
 
+////////////////////////////////////////////////////////////////////////
+// work-group size of the tiled kernel: as large as device and kernel allow (at most 32 x 32),
+// such that the tile with a halo of fSize/2 pixels on each side fits into local memory
+static void getWorkGroupSize(const OCLData& ocl, int fSize, size_t bypp, size_t& lw, size_t& lh) {
+	const cl::Device dev = ocl.m_queue.getInfo<CL_QUEUE_DEVICE>();
+	size_t maxSize;					dev.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &maxSize);
+	vector<size_t> maxItems;		dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_SIZES, &maxItems);
+	cl_ulong localMemSize;			dev.getInfo(CL_DEVICE_LOCAL_MEM_SIZE, &localMemSize);
+	const size_t halo = 2*(fSize/2);
+
+	maxSize = min(maxSize, ocl.m_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev));
+	lw = lh = 32;
+
+	// halve the height first: wide tiles read longer rows of the image
+	while (lw*lh > 1 && (lw*lh > maxSize || lw > maxItems[0] || lh > maxItems[1] || (lw + halo)*(lh + halo)*bypp > localMemSize)) {
+		if (lh >= lw) lh /= 2;
+		else lw /= 2;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// records the event of the next enqueued command, bytes is the size of a transfer or 0
+static cl::Event* addPhase(OCLData& ocl, const char* name, size_t bytes) {
+	ocl.m_phases.push_back(OCLPhase{ name, cl::Event(), bytes });
+	return &ocl.m_phases.back().m_event;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Prints the event profile of the commands of the last call: queued, submit, start and end times
+// relative to the first queued command and the effective bandwidth of each transfer.
+void printProfile(const OCLData& ocl) {
+	if (ocl.m_phases.empty()) return;
+
+	try {
+		const double ms = 1e-6;		// profiling times are in ns
+		const cl_ulong t0 = ocl.m_phases.front().m_event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+		cl_ulong tEnd = t0, transferTime = 0, commandTime = 0;
+		size_t transferBytes = 0;
+
+		cout << "OpenCL profile of " << ocl.m_deviceName << " (ms since the first command was queued)" << endl;
+		for(const OCLPhase& phase: ocl.m_phases) {
+			const cl_ulong queued = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+			const cl_ulong submit = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+			const cl_ulong start = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+			const cl_ulong end = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+			const cl_ulong duration = max(end - start, (cl_ulong)1);
+
+			cout << phase.m_name << ": queued " << (queued - t0)*ms << ", submit " << (submit - t0)*ms << ", start " << (start - t0)*ms
+				<< ", end " << (end - t0)*ms << ", duration " << duration*ms << " ms";
+			if (phase.m_bytes) {
+				cout << ", " << (double)phase.m_bytes/duration << " GB/s";	// bytes per ns
+				transferTime += duration;
+				transferBytes += phase.m_bytes;
+			} else {
+				commandTime += duration;
+			}
+			cout << endl;
+			tEnd = max(tEnd, end);
+		}
+		cout << "transfers " << transferTime*ms << " ms";
+		if (transferBytes) cout << " (" << (double)transferBytes/max(transferTime, (cl_ulong)1) << " GB/s)";
+		cout << ", other commands " << commandTime*ms << " ms, first queued to last end " << (tEnd - t0)*ms << " ms" << endl;
+
+	} catch(cl::Error& err) {
+		cerr << "OpenCL error: " << err.what() << "(" << err.err() << ")" << endl;
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////
 void processOCL(OCLData& ocl, const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize) {
 	const int bypp = 4;
@@ -106,6 +280,7 @@ void processOCL(OCLData& ocl, const fipImage& input, fipImage& output, const int
 	region[0] = w; 
 	region[1] = h; 
 	region[2] = 1;
+	ocl.m_phases.clear();
 
 	try {
 		// the image format describes the properties of each pixel
@@ -125,9 +300,9 @@ void processOCL(OCLData& ocl, const fipImage& input, fipImage& output, const int
 		cl::Buffer ver(ocl.m_context, CL_MEM_READ_ONLY, fSize2*sizeof(int));
 
 		// write buffers to device
-		ocl.m_queue.enqueueWriteImage(source, CL_TRUE, origin, region, stride, 0, input.getScanLine(0));
-		ocl.m_queue.enqueueWriteBuffer(hor, CL_TRUE, 0, fSize2*sizeof(int), hFilter);
-		ocl.m_queue.enqueueWriteBuffer(ver, CL_TRUE, 0, fSize2*sizeof(int), vFilter);
+		ocl.m_queue.enqueueWriteImage(source, CL_TRUE, origin, region, stride, 0, input.getScanLine(0), nullptr, addPhase(ocl, "upload image", w*h*bypp));
+		ocl.m_queue.enqueueWriteBuffer(hor, CL_TRUE, 0, fSize2*sizeof(int), hFilter, nullptr, addPhase(ocl, "upload h filter", fSize2*sizeof(int)));
+		ocl.m_queue.enqueueWriteBuffer(ver, CL_TRUE, 0, fSize2*sizeof(int), vFilter, nullptr, addPhase(ocl, "upload v filter", fSize2*sizeof(int)));
 
 		// set the kernel arguments
 		ocl.m_kernel.setArg(0, source);
@@ -136,12 +311,19 @@ void processOCL(OCLData& ocl, const fipImage& input, fipImage& output, const int
 		ocl.m_kernel.setArg(3, ver);
 		ocl.m_kernel.setArg(4, fSize);
 		ocl.m_kernel.setArg(5, sampler);
+		ocl.m_kernel.setArg(6, (int)w);
+		ocl.m_kernel.setArg(7, (int)h);
+
+		// local memory tile of each work-group: work-group size plus halo
+		size_t lw, lh;
+		getWorkGroupSize(ocl, fSize, bypp, lw, lh);
+		ocl.m_kernel.setArg(8, (lw + 2*(fSize/2))*(lh + 2*(fSize/2))*bypp, nullptr);
 
-		// run the kernels
-		ocl.m_queue.enqueueNDRangeKernel(ocl.m_kernel, cl::NullRange, cl::NDRange(region[0], region[1]), cl::NullRange);
+		// run the kernels: the global size is a multiple of the work-group size
+		ocl.m_queue.enqueueNDRangeKernel(ocl.m_kernel, cl::NullRange, cl::NDRange((w + lw - 1)/lw*lw, (h + lh - 1)/lh*lh), cl::NDRange(lw, lh), nullptr, addPhase(ocl, "kernel", 0));
 
 		// read the output buffer back to the host
-		ocl.m_queue.enqueueReadImage(dest, CL_TRUE, origin, region, stride, 0, output.getScanLine(0));
+		ocl.m_queue.enqueueReadImage(dest, CL_TRUE, origin, region, stride, 0, output.getScanLine(0), nullptr, addPhase(ocl, "download image", w*h*bypp));
 
 	} catch(cl::Error& err) {
 		cerr << "OpenCL error: " << err.what() << "(" << err.err() << ")" << endl;
@@ -17,10 +17,19 @@ typedef unsigned long COLORREF;
 
 string getPath(const char path[], int k = 1);
 
+// event of an enqueued command with the number of transferred bytes (0 for kernels and mappings), see printProfile
+struct OCLPhase {
+	const char* m_name;
+	cl::Event m_event;
+	size_t m_bytes;
+};
+
 struct OCLData {
 	cl::Context m_context;
 	cl::CommandQueue m_queue;
 	cl::Kernel m_kernel;
+	std::string m_deviceName;
+	std::vector<OCLPhase> m_phases;		// commands of the last processOCL call
 };
 
 struct OCLDataCPU : public OCLData {
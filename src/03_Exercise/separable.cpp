@@ -0,0 +1,136 @@
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include "main.h"
+
+////////////////////////////////////////////////////////////////////////
+// Separable convolution: a rank-1 filter f[j][i] = col[j]*row[i] is applied as a vertical 1D pass
+// into a row buffer followed by a horizontal 1D pass, so each pixel costs O(fSize) instead of O(fSize^2)
+
+// non-zero taps of a 1D filter: (offset, weight)
+typedef vector<pair<int, int>> Taps;
+
+////////////////////////////////////////////////////////////////////////
+static BYTE dist(int x, int y) {
+	int d = (int)sqrtf((float)(x*x) + (float)(y*y));
+	return (d < 256) ? d : 255;
+}
+
+////////////////////////////////////////////////////////////////////////
+static int gcd(int a, int b) {
+	while (b) {
+		const int t = a%b;
+		a = b;
+		b = t;
+	}
+	return abs(a);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Factorizes filter[j*fSize + i] = col[j]*row[i] with integer col and row.
+// Returns false if the filter has rank > 1.
+static bool factorize(const int *filter, int fSize, Taps& col, Taps& row) {
+	const int fSizeD2 = fSize/2;
+	const int n = fSize*fSize;
+	int p = 0;
+
+	col.clear();
+	row.clear();
+	while (p < n && filter[p] == 0) p++;
+	if (p == n) return true; // zero filter
+
+	// row: primitive multiple of the first non-zero row, then every row must be an integer multiple of it
+	const int pj = p/fSize, pi = p%fSize;
+	const int *pRow = filter + pj*fSize;
+	int g = 0;
+	for (int i = 0; i < fSize; i++) g = gcd(g, pRow[i]);
+
+	vector<int> r(fSize), c(fSize);
+	for (int i = 0; i < fSize; i++) r[i] = pRow[i]/g;
+	for (int j = 0; j < fSize; j++) {
+		const int f = filter[j*fSize + pi];
+		if (f%r[pi] != 0) return false;
+		c[j] = f/r[pi];
+		for (int i = 0; i < fSize; i++) {
+			if (filter[j*fSize + i] != c[j]*r[i]) return false;
+		}
+	}
+	for (int i = 0; i < fSize; i++) {
+		if (r[i]) row.emplace_back(i - fSizeD2, r[i]);
+		if (c[i]) col.emplace_back(i - fSizeD2, c[i]);
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Returns false (and leaves output unchanged) if one of the filters is not separable
+bool processSeparable(const fipImage& input, fipImage& output, const int *hFilter, const int *vFilter, int fSize) {
+	const int bypp = 4;
+	assert(input.getWidth() == output.getWidth() && input.getHeight() == output.getHeight() && input.getImageSize() == output.getImageSize());
+	assert(input.getBitsPerPixel() == bypp*8);
+
+	Taps hCol, hRow, vCol, vRow;
+	if (!factorize(hFilter, fSize, hCol, hRow) || !factorize(vFilter, fSize, vCol, vRow)) return false;
+
+	const int w = input.getWidth();
+	const int h = input.getHeight();
+	const int fSizeD2 = fSize/2;
+
+	#pragma omp parallel
+	{
+		// per thread row buffers with 3 channels per pixel
+		vector<int> hTmp(3*w), vTmp(3*w);
+
+		#pragma omp for
+		for (int v = fSizeD2; v < h - fSizeD2; v++) {
+			// vertical pass over the whole row
+			fill(hTmp.begin(), hTmp.end(), 0);
+			fill(vTmp.begin(), vTmp.end(), 0);
+			for (const auto& t : hCol) {
+				const RGBQUAD *iC = reinterpret_cast<const RGBQUAD*>(input.getScanLine(v + t.first));
+				int *tmp = hTmp.data();
+				for (int u = 0; u < w; u++, iC++, tmp += 3) {
+					tmp[0] += t.second*iC->rgbBlue;
+					tmp[1] += t.second*iC->rgbGreen;
+					tmp[2] += t.second*iC->rgbRed;
+				}
+			}
+			for (const auto& t : vCol) {
+				const RGBQUAD *iC = reinterpret_cast<const RGBQUAD*>(input.getScanLine(v + t.first));
+				int *tmp = vTmp.data();
+				for (int u = 0; u < w; u++, iC++, tmp += 3) {
+					tmp[0] += t.second*iC->rgbBlue;
+					tmp[1] += t.second*iC->rgbGreen;
+					tmp[2] += t.second*iC->rgbRed;
+				}
+			}
+
+			// horizontal pass on the row buffers
+			RGBQUAD *oC = reinterpret_cast<RGBQUAD*>(output.getScanLine(v)) + fSizeD2;
+			for (int u = fSizeD2; u < w - fSizeD2; u++, oC++) {
+				int hC[3] = { 0, 0, 0 };
+				int vC[3] = { 0, 0, 0 };
+
+				for (const auto& t : hRow) {
+					const int *tmp = &hTmp[3*(u + t.first)];
+					hC[0] += t.second*tmp[0];
+					hC[1] += t.second*tmp[1];
+					hC[2] += t.second*tmp[2];
+				}
+				for (const auto& t : vRow) {
+					const int *tmp = &vTmp[3*(u + t.first)];
+					vC[0] += t.second*tmp[0];
+					vC[1] += t.second*tmp[1];
+					vC[2] += t.second*tmp[2];
+				}
+				oC->rgbBlue = dist(hC[0], vC[0]);
+				oC->rgbGreen = dist(hC[1], vC[1]);
+				oC->rgbRed = dist(hC[2], vC[2]);
+				oC->rgbReserved = 255;
+			}
+		}
+	}
+	return true;
+}
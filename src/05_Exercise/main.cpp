@@ -1,8 +1,11 @@
 #include <iostream>
 #include <cmath>
 #include <climits>
+#include <memory>
 #include <omp.h>
 #include "Stopwatch.h"
+#include "AlignedBuffer.h"
+#include "TlbCounter.h"
 #include "ocl.h"
 
 using namespace std;
@@ -12,7 +15,8 @@ using namespace std;
 void matMultSeq(const int* a, const int* b, int* const c, const int n);
 void matMultCPU(const int* a, const int* b, int* const c, const int n);
 void matMultGPU(OCLData& ocl, const int* a, const int* b, int* const c, const int n);
-OCLData initOCL(const char* kernelFileName, const char* kernelName);
+OCLData initOCL(const char* kernelFileName, const char* kernelName, const char* device);
+void printProfile(const OCLData& ocl);
 
 //////////////////////////////////////////////////////////////////////////////////////////////
 static bool different(const int* const c1, const int* const c2, int n2) {
@@ -20,20 +24,28 @@ static bool different(const int* const c1, const int* const c2, int n2) {
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////
-// Matrix multiplaction tests
-int main() {
+// Matrix multiplaction tests: the optional argument selects the OpenCL device (gpu|cpu|accelerator|all|device-index|device-name),
+// otherwise the environment variable OCL_DEVICE or the first GPU is used
+int main(int argc, const char* argv[]) {
 	Stopwatch swBase, swCPU, swGPU;
+	TlbCounter tlb;
+	bool tlbReported = false;
 	int wrongCPUresults = 0, wrongGPUresults = 0;
-	OCLData ocl = initOCL("matrixmult.cl", "matrixmult");
+	OCLData ocl = initOCL("matrixmult.cl", "matrixmult", (argc > 1) ? argv[1] : nullptr);
+	cout << "OpenCL device: " << ocl.m_deviceName << endl;
 
 	for (int n = 1000; n <= 2000; n += 200) {
 		const int n2 = n*n;
 		const int maxVal = (int)sqrt(INT_MAX/n);
 
-		int *a = new int[n2];
-		int *b = new int[n2];
-		int *c0 = new int[n2];
-		int *c1 = new int[n2];
+		Memory::AlignedArray<int> aBuf = Memory::makeAligned<int>(n2, true);
+		Memory::AlignedArray<int> bBuf = Memory::makeAligned<int>(n2, true);
+		Memory::AlignedArray<int> c0Buf = Memory::makeAligned<int>(n2, true);
+		Memory::AlignedArray<int> c1Buf = Memory::makeAligned<int>(n2, true);
+		int *a = aBuf.get();
+		int *b = bBuf.get();
+		int *c0 = c0Buf.get();
+		int *c1 = c1Buf.get();
 
 		for (int i = 0; i < n2; i++) {
 			a[i] = maxVal*rand()/RAND_MAX;
@@ -41,9 +53,30 @@ int main() {
 		}
 
 		// run serial implementation
+		tlb.Start();
 		swBase.Restart();
 		matMultSeq(a, b, c0, n);
 		swBase.Stop();
+		tlb.Stop();
+
+		// TLB misses of the serial implementation on plain heap arrays compared to the huge-page arrays (first matrix size only)
+		if (!tlbReported) {
+			tlbReported = true;
+			if (tlb.IsAvailable()) {
+				const int64_t hugeMisses = tlb.GetMisses();
+				unique_ptr<int[]> plainA(new int[n2]), plainB(new int[n2]), plainC(new int[n2]);
+				memcpy(plainA.get(), a, n2*sizeof(int));
+				memcpy(plainB.get(), b, n2*sizeof(int));
+
+				tlb.Start();
+				matMultSeq(plainA.get(), plainB.get(), plainC.get(), n);
+				tlb.Stop();
+				cout << "Matrix size " << n << ": dTLB misses: new[]: " << tlb.GetMisses() << ", huge pages: " << hugeMisses
+					<< ", reduction = " << (double)tlb.GetMisses()/max<int64_t>(hugeMisses, 1) << boolalpha << ", same results: " << !different(c0, plainC.get(), n2) << endl;
+			} else {
+				cout << "dTLB misses: not available" << endl;
+			}
+		}
 
 		// run CPU matrix multiplication
 		swCPU.Restart();
@@ -56,13 +89,9 @@ int main() {
 		swGPU.Restart();
 		matMultGPU(ocl, a, b, c1, n);
 		swGPU.Stop();
-		if (different(c0, c1, n2) && !wrongGPUresults) wrongGPUresults = 0;
-
-		// clean-up
-		delete[] a;
-		delete[] b;
-		delete[] c0;
-		delete[] c1;
+		cout << "Matrix size " << n << ": ";
+		printProfile(ocl);
+		if (different(c0, c1, n2) && !wrongGPUresults) wrongGPUresults = n;
 	}
 
 	const double seqTime = swBase.GetElapsedTimeMilliseconds();
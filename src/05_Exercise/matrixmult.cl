@@ -1,5 +1,32 @@
 ///////////////////////////////////////////////////////////////////////////////
-__kernel void matrixmult(const __global int *a, const __global int *b, __global int *c) {
-	// TODO
-}
+// Tile size: the work-group size in both dimensions, must match tileSize in ocl.cpp
+#ifndef TS
+#define TS 16
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// c = a*b for n x n matrices. Each work-group computes a TS x TS tile of c: it walks along the rows of a and the
+// columns of b in steps of TS and stages the two current tiles in local memory, so every element of a and b is read
+// TS times less from global memory. The global size is n rounded up to a multiple of TS: outside elements are zero.
+__kernel void matrixmult(const __global int *a, const __global int *b, __global int *c, const int n) {
+	__local int aTile[TS][TS];
+	__local int bTile[TS][TS];
 
+	const int lc = get_local_id(0);
+	const int lr = get_local_id(1);
+	const int col = get_global_id(0);
+	const int row = get_global_id(1);
+	int sum = 0;
+
+	for (int t = 0; t < n; t += TS) {
+		aTile[lr][lc] = (row < n && t + lc < n) ? a[row*n + t + lc] : 0;
+		bTile[lr][lc] = (t + lr < n && col < n) ? b[(t + lr)*n + col] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (int k = 0; k < TS; k++) {
+			sum += aTile[lr][k]*bTile[k][lc];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (row < n && col < n) c[row*n + col] = sum;
+}
@@ -2,6 +2,11 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <cstdlib>
+#include <cctype>
 #include <iostream>
 #include <cassert>
 #include "ocl.h"
@@ -9,67 +14,155 @@
 using namespace std;
 
 ////////////////////////////////////////////////////////////////////////
-const int devType = CL_DEVICE_TYPE_GPU;
+const size_t tileSize = 16;	// work-group size in both dimensions: TS in matrixmult.cl
 
 ////////////////////////////////////////////////////////////////////////
-OCLData initOCL(const char* kernelFileName, const char* kernelName) {
-	OCLData ocl;
-	vector<cl::Platform> platforms;
-	vector<cl::Device> devices;
+// 64 bit FNV-1a hash
+static unsigned long long fnv1a(const string& s) {
+	unsigned long long hash = 14695981039346656037ULL;
+
+	for(unsigned char c: s) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Builds the program for the first of the given devices with a binary cache: the binary of a source build is stored
+// next to the kernel file under a hash of source, build options, device name and driver version,
+// later runs load it with clCreateProgramWithBinary. A missing or rejected binary falls back to the source build.
+static cl::Program buildProgram(const cl::Context& context, const vector<cl::Device>& devices, const string& source, const char* options, const char* kernelFileName, bool& cached) {
+	// the cache key describes exactly one device, so the program is built for this device only
+	const vector<cl::Device> device(1, devices[0]);
+	string deviceName, driverVersion;
+	device[0].getInfo(CL_DEVICE_NAME, &deviceName);
+	device[0].getInfo(CL_DRIVER_VERSION, &driverVersion);
+
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx", fnv1a(source + '\0' + options + '\0' + deviceName + '\0' + driverVersion));
+	const string cacheName = string(kernelFileName) + "." + hash + ".bin";
+
+	ifstream in(cacheName, ios::binary);
+	if (in.good()) {
+		const vector<char> binary((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
 
-	//cout << "**************************************************************************" << endl;
+		try {
+			cl::Program::Binaries binaries(1, make_pair(binary.data(), binary.size()));
+			cl::Program program(context, device, binaries);
+			program.build(device, options);
+			cached = true;
+			return program;
+		} catch(cl::Error&) {
+			// the binary does not fit the device or driver
+		}
+	}
+
+	cl::Program::Sources progSource(1, make_pair(source.c_str(), source.length() + 1));	// create source code object
+	cl::Program program(context, progSource);												// create program object
+	program.build(device, options);															// build the program for the device
+	cached = false;
+
+	// store the binary of the device; the cache is optional, so errors are ignored
 	try {
-		// discover all available platforms
-		cl::Platform::get(&platforms);
-		if (platforms.empty()) {
-			cerr << "Error: no OpenCL platform available" << endl;
-			return ocl;
+		// the program has one binary per device of the context, only the built device has one with non-zero size
+		const vector<cl::Device> programDevices = program.getInfo<CL_PROGRAM_DEVICES>();
+		const vector<size_t> sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+		const size_t d = find_if(programDevices.begin(), programDevices.end(), [&](const cl::Device& dev) { return dev() == device[0](); }) - programDevices.begin();
+
+		if (d < sizes.size() && sizes[d] > 0) {
+			vector<char> binary(sizes[d]);
+			vector<char*> binaries(sizes.size(), nullptr);	// null entries are skipped
+
+			binaries[d] = binary.data();
+			program.getInfo(CL_PROGRAM_BINARIES, &binaries);
+			ofstream out(cacheName, ios::binary);
+			out.write(binary.data(), binary.size());
 		}
+	} catch(cl::Error&) {
+		// the program stays usable without cache entry
+	}
+	return program;
+}
 
-		string name, profile, version;
-		
-		for(cl::Platform& p: platforms) {
-			p.getInfo(CL_PLATFORM_NAME, &name);
-			p.getInfo(CL_PLATFORM_PROFILE, &profile);
-			p.getInfo(CL_PLATFORM_VERSION, &version);
+////////////////////////////////////////////////////////////////////////
+// Devices sharing memory with the host (CPU devices, integrated GPUs) can use host memory in place (CL_MEM_USE_HOST_PTR).
+// Drivers avoid the copy only for page aligned memory whose size is a multiple of cache lines.
+static bool isZeroCopy(const cl::Device& dev, const void *p, size_t size) {
+	const size_t pageSize = 4096, cacheLineSize = 64;
+	cl_bool unified;				dev.getInfo(CL_DEVICE_HOST_UNIFIED_MEMORY, &unified);
+	cl_uint baseAddrAlign;			dev.getInfo(CL_DEVICE_MEM_BASE_ADDR_ALIGN, &baseAddrAlign); // in bits
+	const size_t alignment = max(pageSize, (size_t)baseAddrAlign/8);
 
-			vector<cl::Device> devs;
+	return unified && reinterpret_cast<uintptr_t>(p)%alignment == 0 && size%cacheLineSize == 0;
+}
 
-			try {
-				// get GPUs of this platform
-				p.getDevices(devType, &devs);
+////////////////////////////////////////////////////////////////////////
+// selection is "gpu", "cpu", "accelerator", "all", a device index in the listed order or a part of the device name
+static bool isSelected(const cl::Device& dev, int index, const string& selection) {
+	cl_device_type type;	dev.getInfo(CL_DEVICE_TYPE, &type);
+	string name;			dev.getInfo(CL_DEVICE_NAME, &name);
 
-			} catch(cl::Error&) {
-				// there is no GPU on this platform
-			}
+	if (selection == "all") return true;
+	if (selection == "gpu") return (type & CL_DEVICE_TYPE_GPU) != 0;
+	if (selection == "cpu") return (type & CL_DEVICE_TYPE_CPU) != 0;
+	if (selection == "accelerator") return (type & CL_DEVICE_TYPE_ACCELERATOR) != 0;
+	if (all_of(selection.begin(), selection.end(), [](char c) { return isdigit((unsigned char)c); })) return index == atoi(selection.c_str());
+
+	auto lower = [](string s) { transform(s.begin(), s.end(), s.begin(), [](char c) { return (char)tolower((unsigned char)c); }); return s; };
+	return lower(name).find(lower(selection)) != string::npos;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Returns the first selected device of all platforms. Without selection
+// the environment variable OCL_DEVICE is used and then the GPUs.
+static bool findDevice(const char* device, cl::Device& selected) {
+	vector<cl::Platform> platforms;
+	const char* env = getenv("OCL_DEVICE");
+	const string selection = (device && *device) ? device : (env && *env) ? env : "gpu";
+	int index = 0;
 
-			if (!devs.empty()) {
-				// show platform
-				//cout << "Platform " << name << " (" << version << ", " << profile << ")" << endl;
-
-				// discover all available GPUs on this platform
-				for(cl::Device& dev: devs) {
-					// get and show device information
-					cl_uint maxComputeUnits;		dev.getInfo(CL_DEVICE_MAX_COMPUTE_UNITS, &maxComputeUnits);
-					cl_uint maxDims;				dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, &maxDims);
-					vector<size_t> workitemSize;	dev.getInfo(CL_DEVICE_MAX_WORK_ITEM_SIZES, &workitemSize);
-					size_t workgroupSize;			dev.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &workgroupSize); // product of all dimension
-					cl_ulong localMemSize;			dev.getInfo(CL_DEVICE_LOCAL_MEM_SIZE, &localMemSize);
-					//cout << "Max. Compute Units: " << maxComputeUnits << ", Max. Dimensions: " << maxDims << " [" << workitemSize[0] << "," << workitemSize[1] << "," << workitemSize[2] << "]" << endl;
-					//cout << "Max. Work Group Size: " << workgroupSize << ", Max. Local Mem Size: " << localMemSize << endl << endl;
-				}
-
-				if (devices.empty()) {
-					// create s_context and command s_queue for the first device
-					cl_context_properties cps[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)(p)(), 0 };
-					ocl.m_context = cl::Context(devType, cps);
-					ocl.m_queue = cl::CommandQueue(ocl.m_context, devs[0]);
-
-					// add first device
-					devices.push_back(devs[0]);
-				}
+	// discover all available platforms
+	cl::Platform::get(&platforms);
+	if (platforms.empty()) {
+		cerr << "Error: no OpenCL platform available" << endl;
+		return false;
+	}
+
+	for(cl::Platform& p: platforms) {
+		vector<cl::Device> devs;
+
+		try {
+			p.getDevices(CL_DEVICE_TYPE_ALL, &devs);
+
+		} catch(cl::Error&) {
+			// there is no device on this platform
+		}
+
+		for(cl::Device& dev: devs) {
+			if (isSelected(dev, index++, selection)) {
+				selected = dev;
+				return true;
 			}
 		}
+	}
+	cerr << "Error: no OpenCL device matches " << selection << endl;
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////
+OCLData initOCL(const char* kernelFileName, const char* kernelName, const char* device) {
+	OCLData ocl;
+
+	try {
+		cl::Device dev;
+		if (!findDevice(device, dev)) return ocl;
+
+		// create s_context and command s_queue for the selected device
+		const vector<cl::Device> devices(1, dev);
+		ocl.m_context = cl::Context(devices);
+		ocl.m_queue = cl::CommandQueue(ocl.m_context, dev, CL_QUEUE_PROFILING_ENABLE);
+		dev.getInfo(CL_DEVICE_NAME, &ocl.m_deviceName);
 
 		// read source file
 		ifstream file(kernelFileName);
@@ -79,34 +172,121 @@ OCLData initOCL(const char* kernelFileName, const char* kernelName) {
 		}
 		string prog(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));	// read in file and store it in string prog
 		file.close();
-		cl::Program::Sources progSource(1, make_pair(prog.c_str(), prog.length() + 1));	// create source code object
 
 		// compile and execute s_kernel code
-		cl::Program program(ocl.m_context, progSource);									// create program object
+		string options;
 	#ifdef _DEBUG
+		cl_device_type devType;
+		dev.getInfo(CL_DEVICE_TYPE, &devType);
 		if (devType == CL_DEVICE_TYPE_CPU) {
-			string s;
-			s.append("-g -s \"").append(kernelFileName).append("\"");
-			program.build(devices, s.c_str());											// start debugger
-		} else
-	#endif
-		{
-			program.build(devices);														// build the program for given devices
+			options.append("-g -s \"").append(kernelFileName).append("\"");			// start debugger
 		}
+	#endif
+		bool cached;
+		cl::Program program = buildProgram(ocl.m_context, devices, prog, options.c_str(), kernelFileName, cached);
 		ocl.m_kernel = cl::Kernel(program, kernelName);									// create the s_kernel: must be the name of the s_kernel in the cl file
 
 		// get device infos
-		devices[0].getInfo(CL_DEVICE_MAX_COMPUTE_UNITS, &ocl.m_computeUnits);
+		dev.getInfo(CL_DEVICE_MAX_COMPUTE_UNITS, &ocl.m_computeUnits);
 
 	} catch(cl::Error& err) {
 		cerr << "OpenCL error: " << err.what() << "(" << err.err() << ")" << endl;
 	}
-	//cout << "**************************************************************************" << endl;
 	return ocl;
 }
 
+////////////////////////////////////////////////////////////////////////
+// records the event of the next enqueued command, bytes is the size of a transfer or 0
+static cl::Event* addPhase(OCLData& ocl, const char* name, size_t bytes) {
+	ocl.m_phases.push_back(OCLPhase{ name, cl::Event(), bytes });
+	return &ocl.m_phases.back().m_event;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Prints the event profile of the commands of the last call: queued, submit, start and end times
+// relative to the first queued command and the effective bandwidth of each transfer.
+void printProfile(const OCLData& ocl) {
+	if (ocl.m_phases.empty()) return;
+
+	try {
+		const double ms = 1e-6;		// profiling times are in ns
+		const cl_ulong t0 = ocl.m_phases.front().m_event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+		cl_ulong tEnd = t0, transferTime = 0, commandTime = 0;
+		size_t transferBytes = 0;
+
+		cout << "OpenCL profile of " << ocl.m_deviceName << " (ms since the first command was queued)" << endl;
+		for(const OCLPhase& phase: ocl.m_phases) {
+			const cl_ulong queued = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+			const cl_ulong submit = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+			const cl_ulong start = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+			const cl_ulong end = phase.m_event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+			const cl_ulong duration = max(end - start, (cl_ulong)1);
+
+			cout << phase.m_name << ": queued " << (queued - t0)*ms << ", submit " << (submit - t0)*ms << ", start " << (start - t0)*ms
+				<< ", end " << (end - t0)*ms << ", duration " << duration*ms << " ms";
+			if (phase.m_bytes) {
+				cout << ", " << (double)phase.m_bytes/duration << " GB/s";	// bytes per ns
+				transferTime += duration;
+				transferBytes += phase.m_bytes;
+			} else {
+				commandTime += duration;
+			}
+			cout << endl;
+			tEnd = max(tEnd, end);
+		}
+		cout << "transfers " << transferTime*ms << " ms";
+		if (transferBytes) cout << " (" << (double)transferBytes/max(transferTime, (cl_ulong)1) << " GB/s)";
+		cout << ", other commands " << commandTime*ms << " ms, first queued to last end " << (tEnd - t0)*ms << " ms" << endl;
+
+	} catch(cl::Error& err) {
+		cerr << "OpenCL error: " << err.what() << "(" << err.err() << ")" << endl;
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////
 void matMultGPU(OCLData& ocl, const int* a, const int* b, int* const c, const int n) {
-	// TODO
-	// do data exchange between CPU and GPU and start the GPU kernel 
+	const size_t size = (size_t)n*n*sizeof(int);
+	ocl.m_phases.clear();
+
+	try {
+		// wrap the matrices if the device can use them in place, otherwise create space for them
+		const cl::Device dev = ocl.m_queue.getInfo<CL_QUEUE_DEVICE>();
+		const bool zeroCopy = isZeroCopy(dev, a, size) && isZeroCopy(dev, b, size) && isZeroCopy(dev, c, size);
+		cl::Buffer aBuf, bBuf, cBuf;
+
+		if (zeroCopy) {
+			aBuf = cl::Buffer(ocl.m_context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, size, const_cast<int*>(a));
+			bBuf = cl::Buffer(ocl.m_context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, size, const_cast<int*>(b));
+			cBuf = cl::Buffer(ocl.m_context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, size, c);
+		} else {
+			aBuf = cl::Buffer(ocl.m_context, CL_MEM_READ_ONLY, size);
+			bBuf = cl::Buffer(ocl.m_context, CL_MEM_READ_ONLY, size);
+			cBuf = cl::Buffer(ocl.m_context, CL_MEM_WRITE_ONLY, size);
+			ocl.m_queue.enqueueWriteBuffer(aBuf, CL_FALSE, 0, size, a, nullptr, addPhase(ocl, "upload a", size));
+			ocl.m_queue.enqueueWriteBuffer(bBuf, CL_FALSE, 0, size, b, nullptr, addPhase(ocl, "upload b", size));
+		}
+
+		// set the kernel arguments
+		ocl.m_kernel.setArg(0, aBuf);
+		ocl.m_kernel.setArg(1, bBuf);
+		ocl.m_kernel.setArg(2, cBuf);
+		ocl.m_kernel.setArg(3, n);
+
+		// run the kernel: the global size is a multiple of the tile size
+		const size_t global = (n + tileSize - 1)/tileSize*tileSize;
+		ocl.m_queue.enqueueNDRangeKernel(ocl.m_kernel, cl::NullRange, cl::NDRange(global, global), cl::NDRange(tileSize, tileSize), nullptr, addPhase(ocl, "kernel", 0));
+
+		if (zeroCopy) {
+			// mapping makes the kernel results visible in the host memory
+			void *mapped = ocl.m_queue.enqueueMapBuffer(cBuf, CL_TRUE, CL_MAP_READ, 0, size, nullptr, addPhase(ocl, "map c", 0));
+			ocl.m_queue.enqueueUnmapMemObject(cBuf, mapped, nullptr, addPhase(ocl, "unmap c", 0));
+			ocl.m_queue.finish();
+		} else {
+			// read the result back to the host
+			ocl.m_queue.enqueueReadBuffer(cBuf, CL_TRUE, 0, size, c, nullptr, addPhase(ocl, "download c", size));
+		}
+
+	} catch(cl::Error& err) {
+		cerr << "OpenCL error: " << err.what() << "(" << err.err() << ")" << endl;
+	}
 }
\ No newline at end of file
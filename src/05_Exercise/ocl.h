@@ -11,11 +11,20 @@
 // error numbers are defined in cl.h 
 //#include <CL/cl.h>
 
+// event of an enqueued command with the number of transferred bytes (0 for kernels and mappings), see printProfile
+struct OCLPhase {
+	const char* m_name;
+	cl::Event m_event;
+	size_t m_bytes;
+};
+
 struct OCLData {
 	cl::Context m_context;
 	cl::CommandQueue m_queue;
 	cl::Kernel m_kernel;
 	cl_uint m_computeUnits;
+	std::string m_deviceName;
+	std::vector<OCLPhase> m_phases;		// commands of the last matMultGPU call
 	// private part
 	size_t m_tileSizeZ = 1;
 };
\ No newline at end of file
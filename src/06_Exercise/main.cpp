@@ -3,9 +3,12 @@
 #include <iostream>
 #include <cassert>
 #include <algorithm>
+#include <memory>
 #include <omp.h>
 #include <ppl.h>
 #include "Stopwatch.h"
+#include "AlignedBuffer.h"
+#include "TlbCounter.h"
 
 using namespace std;
 
@@ -67,9 +70,12 @@ static void tests(int n, int p) {
 	const size_t dataSize = n*sizeof(float);
 
 	Stopwatch sw;
-	float *data = new float[n];
-	float *sortRef = new float[n];
-	float *sort = new float[n];
+	Memory::AlignedArray<float> dataBuf = Memory::makeAligned<float>(n, true);
+	Memory::AlignedArray<float> sortRefBuf = Memory::makeAligned<float>(n, true);
+	Memory::AlignedArray<float> sortBuf = Memory::makeAligned<float>(n, true);
+	float *data = dataBuf.get();
+	float *sortRef = sortRefBuf.get();
+	float *sort = sortBuf.get();
 
 	// init seed
 	time_t now;
@@ -101,7 +107,31 @@ static void tests(int n, int p) {
 	std::sort(sort, sort + n);
 	sw.Stop();
 	cout << "std::sort (n = " << n << ") in " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
-	if (!check(sortRef, sort, n)) goto END;
+	if (!check(sortRef, sort, n)) return;
+
+	// TLB misses of std::sort on a plain heap array compared to the huge-page array
+	{
+		TlbCounter tlb;
+
+		if (tlb.IsAvailable()) {
+			unique_ptr<float[]> plain(new float[n]);
+
+			memcpy(plain.get(), data, dataSize);
+			tlb.Start();
+			std::sort(plain.get(), plain.get() + n);
+			tlb.Stop();
+			const int64_t plainMisses = tlb.GetMisses();
+
+			memcpy(sort, data, dataSize);
+			tlb.Start();
+			std::sort(sort, sort + n);
+			tlb.Stop();
+			cout << "dTLB misses of std::sort: new[]: " << plainMisses << ", huge pages: " << tlb.GetMisses() << ", reduction = " << (double)plainMisses/max<int64_t>(tlb.GetMisses(), 1) << endl;
+			if (!check(sortRef, plain.get(), n) || !check(sortRef, sort, n)) return;
+		} else {
+			cout << "dTLB misses: not available" << endl << endl;
+		}
+	}
 
 	// standard parallel sort
 	memcpy(sort, data, dataSize);
@@ -109,7 +139,7 @@ static void tests(int n, int p) {
 	Concurrency::parallel_sort(sort, sort + n);
 	sw.Stop();
 	cout << "parallel-sort (n = " << n << ") in " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
-	if (!check(sortRef, sort, n)) goto END;
+	if (!check(sortRef, sort, n)) return;
 
 	// sequential quicksort
 	memcpy(sort, data, dataSize);
@@ -117,7 +147,7 @@ static void tests(int n, int p) {
 	quicksort(sort, 0, n - 1);
 	sw.Stop();
 	cout << "quicksort (n = " << n << ") in " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
-	if (!check(sortRef, sort, n)) goto END;
+	if (!check(sortRef, sort, n)) return;
 
 	// parallel quicksort
 	memcpy(sort, data, dataSize);
@@ -125,15 +155,10 @@ static void tests(int n, int p) {
 	parallelQuicksort(sort, 0, n - 1, p);
 	sw.Stop();
 	cout << "parallel quicksort (n = " << n << ", p = " << p << ") in " << sw.GetElapsedTimeMilliseconds() << " ms" << endl;
-	if (!check(sortRef, sort, n)) goto END;
+	if (!check(sortRef, sort, n)) return;
 
 	// output
 	if (n <= 20) print(sort, n);
-
-END:
-	delete[] data;
-	delete[] sortRef;
-	delete[] sort;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <type_traits>
+#ifdef WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/*
+ Aligned arrays with unique_ptr ownership.
+ Large arrays (at least one huge page) are mapped 2 MB aligned and backed by transparent huge pages
+ to reduce TLB misses; smaller arrays are aligned to cache lines, which is also enough for SIMD.
+ On Windows large pages need special privileges, hence all arrays are only cache-line aligned there.
+ */
+namespace Memory {
+	constexpr size_t CacheLineSize = 64;
+	constexpr size_t HugePageSize = 2 << 20;
+	constexpr size_t PageSize = 4096;
+
+	struct AlignedDeleter {
+		size_t m_size = 0;		// mapped size in bytes, 0 if allocated on the heap
+
+		template<typename T>
+		void operator()(T* p) const {
+#ifdef WIN32
+			_aligned_free(p);
+#else
+			if (m_size) munmap(p, m_size); else free(p);
+#endif
+		}
+	};
+
+	template<typename T>
+	using AlignedArray = std::unique_ptr<T[], AlignedDeleter>;
+
+	// allocates n uninitialized elements; prefault touches all pages in advance
+	template<typename T>
+	AlignedArray<T> makeAligned(size_t n, bool prefault = false) {
+		static_assert(std::is_trivial<T>::value, "only trivial element types are supported");
+		const size_t bytes = (n*sizeof(T) + CacheLineSize - 1) & ~(CacheLineSize - 1);
+		AlignedDeleter deleter;
+		void* p = nullptr;
+
+#ifdef WIN32
+		p = _aligned_malloc(bytes, CacheLineSize);
+#else
+		if (bytes >= HugePageSize) {
+			// over-allocate and trim the mapping to a 2 MB aligned range
+			const size_t size = (bytes + HugePageSize - 1) & ~(HugePageSize - 1);
+			char* raw = static_cast<char*>(mmap(nullptr, size + HugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+			if (raw != MAP_FAILED) {
+				char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(raw) + HugePageSize - 1) & ~(HugePageSize - 1));
+				const size_t head = aligned - raw;
+
+				if (head) munmap(raw, head);
+				if (HugePageSize - head) munmap(aligned + size, HugePageSize - head);
+				madvise(aligned, size, MADV_HUGEPAGE);
+				p = aligned;
+				deleter.m_size = size;
+			}
+		}
+		if (!p && posix_memalign(&p, CacheLineSize, bytes) != 0) p = nullptr;
+#endif
+		if (!p) throw std::bad_alloc();
+
+		if (prefault) {
+			char* c = static_cast<char*>(p);
+			for (size_t i = 0; i < bytes; i += PageSize) c[i] = 0;
+		}
+		return AlignedArray<T>(static_cast<T*>(p), deleter);
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/*
+ Counts a user-mode hardware event of the calling thread (and of threads it creates afterwards)
+ with the Linux perf interface.
+ IsAvailable() is false on other systems or if the kernel does not permit the measurement.
+ */
+class PerfCounter {
+	int m_fd;
+	int64_t m_count;
+
+public:
+	enum class Event {
+		DataTlbMisses,		// data TLB read misses
+		CacheMisses,		// last level cache misses: each one is a cache line transferred from or to DRAM
+	};
+
+	explicit PerfCounter(Event event) : m_fd{ -1 }, m_count{ -1 } {
+#ifdef __linux__
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		if (event == Event::DataTlbMisses) {
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		} else {
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		}
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.inherit = 1;
+		m_fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+		(void)event;
+#endif
+	}
+	~PerfCounter() {
+#ifdef __linux__
+		if (m_fd >= 0) close(m_fd);
+#endif
+	}
+	PerfCounter(const PerfCounter&) = delete;
+	PerfCounter& operator=(const PerfCounter&) = delete;
+
+	bool IsAvailable() const {
+		return m_fd >= 0;
+	}
+	void Start() {
+#ifdef __linux__
+		if (m_fd >= 0) {
+			ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+	}
+	void Stop() {
+#ifdef __linux__
+		if (m_fd >= 0) {
+			ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(m_fd, &m_count, sizeof(m_count)) != sizeof(m_count)) m_count = -1;
+		}
+#endif
+	}
+	// number of events between Start and Stop, -1 if not available
+	int64_t GetCount() const {
+		return m_count;
+	}
+};
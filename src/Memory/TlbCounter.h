@@ -0,0 +1,18 @@
+#pragma once
+
+#include "PerfCounter.h"
+
+/*
+ Counts user-mode data TLB misses of the calling thread (and of threads it creates afterwards)
+ with the Linux perf interface.
+ IsAvailable() is false on other systems or if the kernel does not permit the measurement.
+ */
+class TlbCounter : public PerfCounter {
+public:
+	TlbCounter() : PerfCounter(Event::DataTlbMisses) {}
+
+	// number of misses between Start and Stop, -1 if not available
+	int64_t GetMisses() const {
+		return GetCount();
+	}
+};